@@ -1,6 +1,7 @@
 from collections import namedtuple
-from functools import lru_cache
+from functools import lru_cache, update_wrapper
 from collections import Counter
+import numpy as np
 
 
 def baseline_life(pts):
@@ -42,7 +43,42 @@ off = Node(k=0, n=0, hash=0)
 
 mask = (1 << 63) - 1
 
-@lru_cache(maxsize=2 ** 24)
+CacheInfo = namedtuple("CacheInfo", ["hits", "misses", "maxsize", "currsize"])
+
+
+class memo:
+    """
+    Memoise a function on its arguments, like `lru_cache(maxsize=None)`:
+    nothing is ever evicted behind our back, so interned nodes stay unique.
+    Entries are only removed by `collect()`, when they are unreachable.
+    `cache_info()` and `cache_clear()` work as they do for `lru_cache`.
+    """
+
+    def __init__(self, fn):
+        update_wrapper(self, fn)
+        self.fn = fn
+        self.table = {}
+        self.hits = self.misses = 0
+
+    def __call__(self, *args):
+        try:
+            result = self.table[args]
+            self.hits += 1
+            return result
+        except KeyError:
+            self.misses += 1
+            result = self.table[args] = self.fn(*args)
+            return result
+
+    def cache_info(self):
+        return CacheInfo(self.hits, self.misses, None, len(self.table))
+
+    def cache_clear(self):
+        self.table.clear()
+        self.hits = self.misses = 0
+
+
+@memo
 def join(a, b, c, d):
     """
     Combine four children at level `k-1` to a new node at level `k`.
@@ -100,7 +136,7 @@ def life_4x4(m):
     return join(na, nb, nc, nd)
 
 
-@lru_cache(maxsize=2 ** 24)
+@memo
 def successor(m, j=None):
     """
     Return the 2**k-1 x 2**k-1 successor, 2**j generations in the future, 
@@ -139,34 +175,131 @@ def successor(m, j=None):
     return s
 
 
+def collect(*roots):
+    """
+    Free every interned node not reachable from one of `roots`, and every
+    cached successor that refers to one. Nodes are compared by identity, so
+    any node still in use must be one of the roots (or inside one).
+    Returns the number of nodes kept.
+    """
+    keep = set()
+    stack = list(roots)
+    while stack:
+        node = stack.pop()
+        if node.k > 0 and node not in keep:
+            keep.add(node)
+            stack.extend((node.a, node.b, node.c, node.d))
+    join.table = {args: node for args, node in join.table.items() if node in keep}
+    successor.table = {
+        args: node
+        for args, node in successor.table.items()
+        if args[0] in keep and (node.k == 0 or node in keep)
+    }
+    get_zero.cache_clear()
+    return len(join.table)
+
+
+# advance() and ffwd() collect once join() holds more than this many nodes
+# (the bound lru_cache used to have), or twice as many as the last collect kept
+collect_limit = 1 << 24
+_collect_at = 0
+
+
+def collect_if_full(*roots):
+    """
+    `collect(*roots)` if the intern table has passed `collect_limit`.
+    The caller's other nodes stay valid, but are no longer interned, so an
+    equal pattern built later is a different node.
+    """
+    global _collect_at
+    if len(join.table) > max(collect_limit, _collect_at):
+        _collect_at = 2 * collect(*roots)
+
+
+def unique_rows(rows):
+    """
+    The distinct rows of a non-negative integer array, and the index of
+    each row among them. Rows that fit are packed into one uint64 first,
+    which is much faster than sorting them as rows.
+    """
+    bits = 64 // rows.shape[1]
+    if rows.max(initial=0) >> bits == 0:
+        packed = np.zeros(len(rows), dtype=np.uint64)
+        for col in rows.T:
+            packed = (packed << np.uint64(bits)) | col.astype(np.uint64)
+        _, first, inverse = np.unique(packed, return_index=True, return_inverse=True)
+        return rows[first], inverse.reshape(-1)
+    unique, inverse = np.unique(rows, axis=0, return_inverse=True)
+    return unique, inverse.reshape(-1)
+
+
 def construct(pts):
     """
     Turn a list of (x,y) coordinates into a quadtree
     and return the top-level Node.
     """
+    pts = np.array(list(pts), dtype=np.int64).reshape(-1, 2)
+    if len(pts) == 0:
+        return pad(get_zero(3))
     # Force start at (0,0)
-    min_x = min(*[x for x, y in pts])
-    min_y = min(*[y for x, y in pts])
-    pattern = {(x - min_x, y - min_y): on for x, y in pts}
+    xs = pts[:, 0] - pts[:, 0].min()
+    ys = pts[:, 1] - pts[:, 1].min()
+    # the nodes at level k are nodes[index[i]], at (xs[i], ys[i])
+    nodes, index = [on], np.zeros(len(xs), dtype=np.intp)
     k = 0
-    while len(pattern) != 1:
-        # bottom-up construction
-        next_level = {}
-        z = get_zero(k)
-        while len(pattern) > 0:
-            x, y = next(iter(pattern))
-            x, y = x - (x & 1), y - (y & 1)
-            # read all 2x2 neighbours, removing from those to work through
-            # at least one of these must exist by definition
-            a = pattern.pop((x, y), z)
-            b = pattern.pop((x + 1, y), z)
-            c = pattern.pop((x, y + 1), z)
-            d = pattern.pop((x + 1, y + 1), z)
-            next_level[x >> 1, y >> 1] = join(a, b, c, d)
-        # merge at the next level
-        pattern = next_level
+    while len(index) > 1 or k == 0:
+        # bottom-up construction: group the nodes by their parent,
+        # and place each in its quadrant (a=0, b=1, c=2, d=3)
+        parents, parent = unique_rows(np.stack([xs >> 1, ys >> 1], axis=1))
+        children = np.full((len(parents), 4), len(nodes))  # all zero...
+        children[parent, (xs & 1) | ((ys & 1) << 1)] = index  # ...but for the nodes we have
+        # only join each distinct set of four children once
+        kinds, index = unique_rows(children)
+        level = nodes + [get_zero(k)]
+        nodes = [join(*[level[i] for i in row]) for row in kinds.tolist()]
+        xs, ys = parents[:, 0], parents[:, 1]
         k += 1
-    return pad(pattern.popitem()[1])
+    return pad(nodes[index[0]])
+
+
+def expand_array(node, x=0, y=0, clip=None, level=0):
+    """
+    As `expand()`, but returns arrays `(xs, ys, gray)`, one entry per
+    non-empty block. The tree is walked a level at a time, visiting each
+    distinct node once per level, and the positions of all its copies are
+    worked out together.
+    """
+    nodes, index = [node], np.zeros(1, dtype=np.intp)
+    xs, ys = np.array([x], dtype=np.int64), np.array([y], dtype=np.int64)
+    k = node.k
+
+    def clipped(xs, ys, index, size):
+        if clip is None:
+            return xs, ys, index
+        inside = ~((xs + size < clip[0]) | (xs > clip[1]) | (ys + size < clip[2]) | (ys > clip[3]))
+        return xs[inside], ys[inside], index[inside]
+
+    if node.n == 0:
+        index = index[:0]
+    xs, ys, index = clipped(xs, ys, index, 1 << k)
+    while k > level and len(index):
+        # the non-empty children of each distinct node (-1 for empty)
+        kinds, children = {}, np.full((len(nodes), 4), -1)
+        for i, m in enumerate(nodes):
+            for q, child in enumerate((m.a, m.b, m.c, m.d)):
+                if child.n:
+                    children[i, q] = kinds.setdefault(child, len(kinds))
+        nodes = list(kinds)
+        k -= 1
+        offset = 1 << k
+        children = children[index]
+        present = children >= 0
+        xs = (xs[:, None] + np.array([0, offset, 0, offset]))[present]
+        ys = (ys[:, None] + np.array([0, 0, offset, offset]))[present]
+        xs, ys, index = clipped(xs, ys, children[present], offset)
+    # the gray level of each node
+    gray = np.array([m.n for m in nodes], dtype=np.float64)[index] / 4.0 ** k
+    return xs >> level, ys >> level, gray
 
 
 def expand(node, x=0, y=0, clip=None, level=0):
@@ -175,7 +308,14 @@ def expand(node, x=0, y=0, clip=None, level=0):
     If `level` is given, quadtree elements at the given level are given 
     as a grayscale level 0.0->1.0,  "zooming out" the display.
     """
+    if node.k < 62:
+        xs, ys, gray = expand_array(node, x, y, clip, level)
+        return list(zip(xs.tolist(), ys.tolist(), gray.tolist()))
+    return expand_recursive(node, x, y, clip, level)
+
 
+def expand_recursive(node, x=0, y=0, clip=None, level=0):
+    """As `expand()`, one node at a time, for nodes too large for int64 coordinates"""
     if node.n == 0:  # quick zero check
         return []
     size = 2 ** node.k
@@ -191,10 +331,10 @@ def expand(node, x=0, y=0, clip=None, level=0):
         # return all points contained inside this node
         offset = size >> 1
         return (
-            expand(node.a, x, y, clip, level)
-            + expand(node.b, x + offset, y, clip, level)
-            + expand(node.c, x, y + offset, clip, level)
-            + expand(node.d, x + offset, y + offset, clip, level)
+            expand_recursive(node.a, x, y, clip, level)
+            + expand_recursive(node.b, x + offset, y, clip, level)
+            + expand_recursive(node.c, x, y + offset, clip, level)
+            + expand_recursive(node.d, x + offset, y + offset, clip, level)
         )
 
 
@@ -264,6 +404,7 @@ def ffwd(node, n):
         node = centre(centre(pad(node)))
         gens += 1 << (node.k - 2)
         node = successor(node)
+        collect_if_full(node)
     return node, gens
 
 
@@ -285,6 +426,7 @@ def advance(node, n):
         j = len(bits) - k - 1
         if bit:
             node = successor(node, j)
+            collect_if_full(node)
     return crop(node)
 
 
@@ -0,0 +1,259 @@
+/*
+    Benchmark suite for the HashLife engine.
+
+    Usage: bench [-t trials] [-o out.json] <pattern> ...  (RLE, Life 1.05/1.06 or plaintext)
+
+    Every pattern is loaded once; each timed operation then runs on a
+    fresh copy of that table, so caches start equally cold in every trial.
+    Results (median and percentile times, nodes created per second, peak RSS)
+    are written as JSON, to track regressions between versions.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "hashlife.h"
+#include "cell_io.h"
+#include "timeit.h"
+#include <sys/resource.h>
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#define MAX_TRIALS 101
+#define RASTER_SIZE 512
+#define BENCH_SAMPLES 16 // steps per stepper sample
+
+typedef struct sample
+{
+    uint64_t ns;
+    uint64_t nodes; // nodes created during the timed region
+} sample;
+
+/* A timed operation; fills in one sample */
+typedef void (*bench_op)(node_table *base, node_id id, const char *filename, uint64_t arg, sample *s);
+
+static void op_load(node_table *base, node_id id, const char *filename, uint64_t arg, sample *s)
+{
+    (void)base, (void)id, (void)arg;
+    node_table *table = create_table(INIT_TABLE_SIZE);
+    uint64_t t0 = now_ns();
+    read_life_file(table, (char *)filename);
+    s->ns = now_ns() - t0;
+    s->nodes = table->count;
+    free_table(table);
+}
+
+static void op_advance(node_table *base, node_id id, const char *filename, uint64_t steps, sample *s)
+{
+    (void)filename;
+    node_table *table = copy_table(base);
+    uint64_t before = table->count;
+    uint64_t t0 = now_ns();
+    advance(table, id, steps);
+    s->ns = now_ns() - t0;
+    s->nodes = table->count - before;
+    free_table(table);
+}
+
+static void op_ffwd(node_table *base, node_id id, const char *filename, uint64_t leaps, sample *s)
+{
+    (void)filename;
+    uint64_t generations;
+    node_table *table = copy_table(base);
+    uint64_t before = table->count;
+    uint64_t t0 = now_ns();
+    ffwd(table, id, leaps, &generations);
+    s->ns = now_ns() - t0;
+    s->nodes = table->count - before;
+    free_table(table);
+}
+
+/* Sample every `stride` generations, BENCH_SAMPLES times */
+static void op_stepper(node_table *base, node_id id, const char *filename, uint64_t stride, sample *s)
+{
+    (void)filename;
+    stepper st;
+    node_table *table = copy_table(base);
+    uint64_t before = table->count;
+    uint64_t t0 = now_ns();
+    stepper_init(table, &st, id, stride);
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+        stepper_step(table, &st);
+    s->ns = now_ns() - t0;
+    s->nodes = table->count - before;
+    free_table(table);
+}
+
+/* Vacuum a table holding the garbage of an advance */
+static void op_vacuum(node_table *base, node_id id, const char *filename, uint64_t steps, sample *s)
+{
+    (void)filename;
+    node_table *table = copy_table(base);
+    node_id future = advance(table, id, steps);
+    uint64_t t0 = now_ns();
+    vacuum(table, future);
+    s->ns = now_ns() - t0;
+    s->nodes = 0;
+    free_table(table);
+}
+
+static void op_to_rle(node_table *base, node_id id, const char *filename, uint64_t arg, sample *s)
+{
+    (void)filename, (void)arg;
+    uint64_t t0 = now_ns();
+    char *rle = to_rle(base, id);
+    s->ns = now_ns() - t0;
+    s->nodes = 0;
+    free(rle);
+}
+
+/* Rasterise the whole pattern into a RASTER_SIZE square */
+static void op_rasterise(node_table *base, node_id id, const char *filename, uint64_t arg, sample *s)
+{
+    (void)filename, (void)arg;
+    static float buf[RASTER_SIZE * RASTER_SIZE];
+    uint64_t size = 1ULL << LEVEL(id);
+    uint64_t min_level = 0;
+    while ((size >> min_level) > RASTER_SIZE)
+        min_level++;
+    uint64_t t0 = now_ns();
+    rasterise(base, id, buf, RASTER_SIZE, RASTER_SIZE, 0, 0, size, size, min_level);
+    s->ns = now_ns() - t0;
+    s->nodes = 0;
+}
+
+/* Iterate over the live cells of the pattern advanced 1024 generations,
+    in a table allocated with arg (ALLOC_* flags); an arena is laid out first */
+static void op_cells(node_table *base, node_id id, const char *filename, uint64_t flags, sample *s)
+{
+    (void)base, (void)id;
+    node_table *table = create_table_alloc(INIT_TABLE_SIZE, (uint32_t)flags);
+    node_id future = advance(table, read_life_file(table, (char *)filename), 1024);
+    vacuum(table, future);
+    relayout(table, &future, 1, RELAYOUT_DFS);
+    cell_iter it;
+    int64_t xy[2 * 256];
+    uint64_t t0 = now_ns();
+    cell_iter_init(table, &it, future, 0, 0);
+    while (cell_iter_next(&it, xy, 256))
+        ;
+    s->ns = now_ns() - t0;
+    s->nodes = 0;
+    free_table(table);
+}
+
+typedef struct bench_case
+{
+    const char *name;
+    bench_op op;
+    uint64_t arg;
+} bench_case;
+
+static const bench_case suite[] = {
+    {"load", op_load, 0},
+    {"advance_1", op_advance, 1},
+    {"advance_64", op_advance, 64},
+    {"advance_1024", op_advance, 1024},
+    {"advance_65536", op_advance, 65536},
+    {"ffwd_8", op_ffwd, 8},
+    {"stepper_1024x16", op_stepper, 1024},
+    {"vacuum_1024", op_vacuum, 1024},
+    {"to_rle", op_to_rle, 0},
+    {"rasterise", op_rasterise, 0},
+    {"cells_1024", op_cells, ALLOC_DEFAULT},
+    {"arena_cells_1024", op_cells, ALLOC_DEFAULT | ALLOC_ARENA},
+};
+
+static int cmp_sample(const void *a, const void *b)
+{
+    uint64_t x = ((const sample *)a)->ns, y = ((const sample *)b)->ns;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const sample *s, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+    return s[rank > 0 ? rank - 1 : 0].ns;
+}
+
+static uint64_t peak_rss_kb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)ru.ru_maxrss;
+}
+
+static void bench_pattern(FILE *out, const char *filename, int trials, bool last)
+{
+    node_table *base = create_table(INIT_TABLE_SIZE);
+    node_id id = read_life_file(base, (char *)filename);
+    sample samples[MAX_TRIALS];
+    int n_cases = sizeof(suite) / sizeof(suite[0]);
+
+    fprintf(stderr, "%s: level %llu, population %llu\n", filename,
+            (unsigned long long)LEVEL(id), (unsigned long long)lookup(base, id)->pop);
+    fprintf(out, "    {\n      \"file\": \"%s\",\n      \"level\": %llu,\n      \"population\": %llu,\n      \"ops\": [\n",
+            filename, (unsigned long long)LEVEL(id), (unsigned long long)lookup(base, id)->pop);
+    for (int c = 0; c < n_cases; c++)
+    {
+        uint64_t total_ns = 0, total_nodes = 0;
+        for (int t = 0; t < trials; t++)
+        {
+            suite[c].op(base, id, filename, suite[c].arg, &samples[t]);
+            total_ns += samples[t].ns;
+            total_nodes += samples[t].nodes;
+        }
+        qsort(samples, trials, sizeof(sample), cmp_sample);
+        double nodes_per_sec = total_ns ? total_nodes / (total_ns / 1e9) : 0.0;
+        fprintf(stderr, "  %-14s median %12.3f ms  p90 %12.3f ms  %12.0f nodes/s\n", suite[c].name,
+                percentile(samples, trials, 50) / 1e6, percentile(samples, trials, 90) / 1e6, nodes_per_sec);
+        fprintf(out, "        {\"name\": \"%s\", \"trials\": %d, \"min_ns\": %llu, \"median_ns\": %llu, "
+                     "\"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"nodes_per_sec\": %.0f}%s\n",
+                suite[c].name, trials,
+                (unsigned long long)samples[0].ns,
+                (unsigned long long)percentile(samples, trials, 50),
+                (unsigned long long)percentile(samples, trials, 90),
+                (unsigned long long)percentile(samples, trials, 99),
+                (unsigned long long)samples[trials - 1].ns,
+                nodes_per_sec, c + 1 < n_cases ? "," : "");
+    }
+    fprintf(out, "      ],\n      \"peak_rss_kb\": %llu\n    }%s\n", (unsigned long long)peak_rss_kb(), last ? "" : ",");
+    free_table(base);
+}
+
+int main(int argc, char **argv)
+{
+    int trials = 7;
+    FILE *out = stdout;
+    int first = 1;
+    while (first < argc && argv[first][0] == '-')
+    {
+        if (!strcmp(argv[first], "-t") && first + 1 < argc)
+            trials = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "-o") && first + 1 < argc)
+        {
+            out = fopen(argv[first + 1], "w");
+            if (!out)
+            {
+                printf("Failed to open output file: %s\n", argv[first + 1]);
+                return 1;
+            }
+        }
+        else
+            break;
+        first += 2;
+    }
+    if (first >= argc || trials < 1 || trials > MAX_TRIALS)
+    {
+        printf("Usage: %s [-t trials (1-%d)] [-o out.json] <pattern> ...\n", argv[0], MAX_TRIALS);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"revision\": \"%s\",\n  \"trials\": %d,\n  \"patterns\": [\n", BENCH_REV, trials);
+    for (int i = first; i < argc; i++)
+        bench_pattern(out, argv[i], trials, i + 1 == argc);
+    fprintf(out, "  ],\n  \"peak_rss_kb\": %llu\n}\n", (unsigned long long)peak_rss_kb());
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -1,12 +1,54 @@
-#include "hashlife.h"
+#define _POSIX_C_SOURCE 200809L
+#include "cell_io.h"
+#include "trace.h"
 #include <string.h>
 
+/* Live cells gathered while parsing, to be set in one apply_edits() pass */
+typedef struct live_cells
+{
+    int64_t *xy;
+    uint64_t n, max;
+} live_cells;
+
+static void add_live(live_cells *cells, int64_t x, int64_t y)
+{
+    if (cells->n == cells->max)
+    {
+        cells->max = cells->max ? cells->max * 2 : 256;
+        cells->xy = realloc(cells->xy, 2 * cells->max * sizeof(int64_t));
+    }
+    cells->xy[2 * cells->n] = x;
+    cells->xy[2 * cells->n++ + 1] = y;
+}
+
+/* The node holding the gathered cells (frees them). With normalise, the
+    cells are first moved so the lowest x and y are 0 (for formats with
+    negative coordinates); otherwise they must not be negative. */
+static node_id build_live(node_table *table, live_cells *cells, bool normalise)
+{
+    int64_t x0 = 0, y0 = 0;
+    for (uint64_t i = 0; normalise && i < cells->n; i++)
+    {
+        x0 = (i == 0 || cells->xy[2 * i] < x0) ? cells->xy[2 * i] : x0;
+        y0 = (i == 0 || cells->xy[2 * i + 1] < y0) ? cells->xy[2 * i + 1] : y0;
+    }
+    uint64_t *xy = (uint64_t *)cells->xy; // same storage, as offsets from (x0, y0)
+    for (uint64_t i = 0; i < cells->n; i++)
+    {
+        xy[2 * i] = (uint64_t)(cells->xy[2 * i] - x0);
+        xy[2 * i + 1] = (uint64_t)(cells->xy[2 * i + 1] - y0);
+    }
+    node_id root = set_cells(table, get_zero(table, 2), xy, cells->n);
+    free(cells->xy);
+    return root;
+}
+
 /* Read a .* style plain text pattern
     and return the corresponding hashlife node
 */
 node_id from_text(node_table *table, char *txt)
 {
-    node_id root = get_zero(table, 2);
+    live_cells cells = {0};
     uint64_t x = 0, y = 0;
     char *p = txt;
     while (*p)
@@ -14,7 +56,7 @@ node_id from_text(node_table *table, char *txt)
         switch (*p++)
         {
         case 'O':
-            root = set_cell(table, root, x, y, 1);
+            add_live(&cells, x, y);
             x++;
             break;
         case '.':
@@ -26,7 +68,7 @@ node_id from_text(node_table *table, char *txt)
             break;
         }
     }
-    return root;
+    return build_live(table, &cells, false);
 }
 
 /* Convert a hashlife node to a .* style plain text pattern
@@ -92,6 +134,7 @@ void rasterise(node_table *table, node_id id, float *buf, uint64_t buf_width, ui
     uint64_t pixel_width = width >> min_level;
     uint64_t pixel_height = height >> min_level;
     assert(pixel_width <= buf_width && pixel_height <= buf_height);
+    (void)buf_height; // only checked by the assert
 
     for (uint64_t j = 0; j < pixel_height; j++)
         for (uint64_t i = 0; i < pixel_width; i++)
@@ -136,18 +179,47 @@ char *read_one(char *s, char *state, int *count)
     return s;
 }
 
+/* Set the rule a pattern file named, if any, warning if it is not supported */
+static void apply_rule(node_table *table, const char *rule)
+{
+    if (rule[0] && set_rule(table, rule))
+        fprintf(stderr, "Unsupported rule:%s\n", rule);
+}
+
 /*
     Take an RLE string, ignore any size or comment information
-    and insert the live cells into a hashlife node table, returning the root node_id
+    and insert the live cells into a hashlife node table, returning the root node_id.
+    A rule in the header ("x = 3, y = 3, rule = B36/S23") becomes the table's rule.
 */
 node_id from_rle(node_table *table, char *rle_str)
+{
+    char rule[RULE_NAME_LEN];
+    node_id id = from_rle_rule(table, rle_str, rule);
+    apply_rule(table, rule);
+    return id;
+}
+
+/* As from_rle(), but the header's rule is copied into rule (RULE_NAME_LEN
+    bytes; "" if there is none) rather than set on the table */
+node_id from_rle_rule(node_table *table, char *rle_str, char *rule)
 {
     char *s = rle_str;
+    rule[0] = 0;
+    // skip comments to the header line
+    char *header = rle_str;
+    while (*header == '#' || isspace((unsigned char)*header))
+        header = *header == '#' ? header + strcspn(header, "\n") : header + 1;
+    int header_len = (int)strcspn(header, "\n");
+    char *rule_key = *header == 'x' ? strstr(header, "rule") : NULL;
+    if (rule_key && rule_key - header < header_len && (rule_key = strchr(rule_key, '=')))
+    {
+        int len = (int)strcspn(rule_key + 1, ",\r\n");
+        snprintf(rule, RULE_NAME_LEN, "%.*s", len, rule_key + 1);
+    }
     char state;
     int count;
     uint64_t x = 0, y = 0;
-    node_id root = get_zero(table, 2);
-    int pop = 0;
+    live_cells cells = {0};
     while (1)
     {
         s = read_one(s, &state, &count);
@@ -161,10 +233,8 @@ node_id from_rle(node_table *table, char *rle_str)
         {
             for (int i = 0; i < count; i++)
             {
-                root = set_cell(table, root, x, y, true);
-
+                add_live(&cells, x, y);
                 x++;
-                pop++;
             }
         }
         else if (state == '$')
@@ -173,8 +243,7 @@ node_id from_rle(node_table *table, char *rle_str)
             x = 0;
         }
     }
-
-    return root;
+    return build_live(table, &cells, false);
 }
 
 
@@ -189,7 +258,7 @@ char *to_rle(node_table *table, node_id id)
     char *p = buf;
     uint64_t size = 1ULL << LEVEL(id);
     uint64_t count;
-    p += sprintf(p, "x=%llu,y=%llu, rule = B3/S23\n", size, size);
+    p += sprintf(p, "x=%llu,y=%llu, rule = %s\n", (unsigned long long)size, (unsigned long long)size, table->rule.name);
 
     float cell_value;
     for (uint64_t y = 0; y < size; y++)
@@ -255,6 +324,7 @@ node_id read_rle(node_table *table, char *filename)
     long fsize = ftell(f);
     fseek(f, 0, SEEK_SET);
 
+    TRACE_BEGIN(t0, true);
     char *buf = malloc(fsize + 1);
     fread(buf, 1, fsize, f);
     buf[fsize] = 0;
@@ -262,6 +332,7 @@ node_id read_rle(node_table *table, char *filename)
 
     node_id id = from_rle(table, buf);
     free(buf);
+    TRACE_END(t0, "read_rle", LEVEL(id), "bytes", fsize);
     return id;
 }
 
@@ -273,9 +344,164 @@ int write_rle(node_table *node_table, node_id node, char *filename)
         printf("Failed to open RLE file for writing: %s\n", filename);
         return 1;
     }
+    TRACE_BEGIN(t0, true);
     char *buf = to_rle(node_table, node);
-    fwrite(buf, 1, strlen(buf), f);
+    size_t len = strlen(buf);
+    fwrite(buf, 1, len, f);
     free(buf);
     fclose(f);
+    TRACE_END(t0, "write_rle", LEVEL(node), "bytes", len);
     return 0;
-}
\ No newline at end of file
+}
+/* Is the line a row of cells ('.', '*', 'o' or 'O', with optional repeat
+    counts as in DBLife), and not blank? */
+static bool is_cell_row(const char *line)
+{
+    bool cells = false;
+    for (; *line; line++)
+        if (strchr(".*oO", *line))
+            cells = true;
+        else if (!isdigit((unsigned char)*line) && !isspace((unsigned char)*line))
+            return false;
+    return cells;
+}
+
+/* Is the line a pair of integer coordinates (Life 1.06)? */
+static bool is_coordinate_pair(const char *line, long long *x, long long *y)
+{
+    char extra;
+    return sscanf(line, "%lld %lld %c", x, y, &extra) == 2;
+}
+
+/* Add the live cells of one row, starting at (x, y) */
+static void add_row(live_cells *cells, const char *line, int64_t x, int64_t y)
+{
+    int64_t count = 0;
+    for (; *line; line++)
+    {
+        if (isdigit((unsigned char)*line))
+        {
+            count = count * 10 + (*line - '0');
+            continue;
+        }
+        int64_t run = count ? count : 1;
+        if (*line == '.')
+            x += run;
+        else if (strchr("*oO", *line))
+            for (int64_t i = 0; i < run; i++)
+                add_live(cells, x++, y);
+        count = 0;
+    }
+}
+
+/* Read a pattern from a stream, in any of:
+    - Life 1.05: "#Life 1.05", then rows of '.' and '*', in blocks placed by
+      "#P x y" lines (which may be negative); "#N" and "#R s/b" set the rule
+    - Life 1.06: "#Life 1.06", then one "x y" pair per live cell
+    - plaintext (.cells, and DBLife with repeat counts): '!' comment lines,
+      then rows of '.' and 'O' (a blank line is an empty row)
+    - RLE
+    The format is guessed as lifeparsers.py's autoguess_life_file() does: a
+    "#Life" header names it, otherwise the first line that is not a
+    comment decides. Lines are read one at a time and cells are set in one
+    set_cells() pass; only RLE (passed to from_rle()) is read whole. Cells
+    are moved so the lowest x and y are 0. A rule the file names becomes
+    the table's rule.
+*/
+node_id read_life_stream(node_table *table, FILE *f)
+{
+    char rule[RULE_NAME_LEN];
+    node_id id = read_life_stream_rule(table, f, rule);
+    apply_rule(table, rule);
+    return id;
+}
+
+/* As read_life_stream(), but the rule the file names is copied into rule
+    (RULE_NAME_LEN bytes; "" if none) rather than set on the table */
+node_id read_life_stream_rule(node_table *table, FILE *f, char *rule)
+{
+    char *line = NULL, *head = NULL;
+    size_t cap = 0, head_len = 0;
+    ssize_t len;
+    int format = -1;
+    live_cells cells = {0};
+    int64_t ox = 0, y = 0; // Life 1.05 block origin, and the next row
+    long long px, py;
+    rule[0] = 0;
+    while ((len = getline(&line, &cap, f)) >= 0)
+    {
+        if (format < 0 || format == LIFE_RLE)
+        {
+            // keep every line until the format is known, in case it is RLE
+            head = realloc(head, head_len + len + 1);
+            memcpy(head + head_len, line, len + 1);
+            head_len += len;
+        }
+        while (len > 0 && isspace((unsigned char)line[len - 1]))
+            line[--len] = 0;
+        if (format < 0)
+        {
+            if (!strncmp(line, "#Life 1.05", 10))
+                format = LIFE_105;
+            else if (!strncmp(line, "#Life 1.06", 10))
+                format = LIFE_106;
+            else if (line[0] == '#' && (line[1] == 'P' || line[1] == 'p'))
+                format = LIFE_105;
+            else if (line[0] == '#' || line[0] == '!' || len == 0)
+                ;
+            else if (is_coordinate_pair(line, &px, &py))
+                format = LIFE_106;
+            else if (is_cell_row(line))
+                format = LIFE_PLAIN;
+            else
+                format = LIFE_RLE;
+        }
+
+        if (format == LIFE_RLE)
+            continue;
+        if (line[0] == '#') // only Life 1.05 has meaningful # lines
+        {
+            if (format != LIFE_105)
+                continue;
+            if ((line[1] == 'P' || line[1] == 'p') && sscanf(line + 2, "%lld %lld", &px, &py) == 2)
+                ox = px, y = py;
+            else if (line[1] == 'N')
+                snprintf(rule, RULE_NAME_LEN, "B3/S23");
+            else if (line[1] == 'R')
+                snprintf(rule, RULE_NAME_LEN, "%s", line + 2);
+        }
+        else if (format == LIFE_105 && is_cell_row(line))
+            add_row(&cells, line, ox, y++);
+        else if (format == LIFE_106 && is_coordinate_pair(line, &px, &py))
+            add_live(&cells, px, py);
+        else if (format == LIFE_PLAIN && line[0] != '!')
+            add_row(&cells, line, 0, y++);
+    }
+    free(line);
+
+    if (format == LIFE_RLE)
+    {
+        free(cells.xy);
+        node_id id = from_rle_rule(table, head, rule);
+        free(head);
+        return id;
+    }
+    free(head);
+    return build_live(table, &cells, true);
+}
+
+/* Load a pattern in any format read_life_stream() knows */
+node_id read_life_file(node_table *table, char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+    {
+        printf("Failed to open life file: %s\n", filename);
+        exit(1);
+    }
+    TRACE_BEGIN(t0, true);
+    node_id id = read_life_stream(table, f);
+    fclose(f);
+    TRACE_END(t0, "read_life_file", LEVEL(id), "pop", lookup(table, id)->pop);
+    return id;
+}
@@ -4,10 +4,23 @@
 bool is_tok(char ch);
 char *read_one(char *s, char *state, int *count);
 node_id from_rle(node_table *table, char *rle_str);
+node_id from_rle_rule(node_table *table, char *rle_str, char *rule);
 char *to_rle(node_table *table, node_id id); // caller frees
 node_id from_text(node_table *table, char *text);
 char *to_text(node_table *table, node_id id); // caller frees
 void rasterise(node_table *table, node_id id, float *buf, uint64_t buf_width, uint64_t buf_height, uint64_t x, uint64_t y, uint64_t width, uint64_t height, uint64_t min_level);
 uint64_t hash_life_text(char *text);
 node_id read_rle(node_table *table, char *filename);
-int write_rle(node_table *node_table, node_id node, char *filename);
\ No newline at end of file
+int write_rle(node_table *node_table, node_id node, char *filename);
+
+/* Other life file formats, as guessed by read_life_stream() */
+enum
+{
+    LIFE_RLE,
+    LIFE_105,
+    LIFE_106,
+    LIFE_PLAIN
+};
+node_id read_life_stream(node_table *table, FILE *f);
+node_id read_life_stream_rule(node_table *table, FILE *f, char *rule);
+node_id read_life_file(node_table *table, char *filename);
\ No newline at end of file
@@ -7,6 +7,9 @@
 
 */
 #include "hashlife.h"
+#include "shared.h"
+#include "timeit.h"
+#include "trace.h"
 
 /* SplitMix64 mixing function */
 uint64_t mix64(uint64_t x)
@@ -32,30 +35,162 @@ uint64_t hash_quad(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
     return mix64(h);
 }
 
-/*  One attempt lookup in the successor cache
-    (no probing, collisions cause recomputation)
+static void clean_cache(node_table *table);
+
+/* The successor cache's slots: layered under the nodes, or apart from them in an arena table */
+static inline node *cache_slots(node_table *table)
+{
+    return table->cache ? table->cache : table->index;
+}
+
+/* The cache seqlock guarding slot n (and the rest of its bucket) of a shared table (NULL if private) */
+static uint64_t *cache_seq(node_table *table, node *n)
+{
+    return table->shared ? &table->shared->seq[(n - table->index) / CACHE_WAYS % SHARED_STRIPES] : NULL;
+}
+
+/* Read slot n's cache entry into e; false if a writer got in the way */
+static bool read_entry(node_table *table, node *n, node *e)
+{
+    uint64_t *seq = cache_seq(table, n);
+    if (!seq)
+    {
+        e->from = n->from;
+        e->to = n->to;
+        e->j = n->j;
+        return true;
+    }
+    uint64_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    e->from = __atomic_load_n(&n->from, __ATOMIC_RELAXED);
+    e->to = __atomic_load_n(&n->to, __ATOMIC_RELAXED);
+    e->j = __atomic_load_n(&n->j, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(s & 1) && __atomic_load_n(seq, __ATOMIC_RELAXED) == s;
+}
+
+/* The age of a cache entry: contests survived since it was last hit */
+static inline uint64_t entry_age(const node *e)
+{
+    return IS_MARKED(e->from) | IS_MARKED(e->to) << 1;
+}
+
+static inline void set_age(node *e, uint64_t age)
+{
+    e->from = (age & 1) ? MARK(e->from) : UNMARK(e->from);
+    e->to = (age & 2) ? MARK(e->to) : UNMARK(e->to);
+}
+
+/* What keeping a cache entry is worth: roughly the levels of work to
+    recompute it, halved for each contest it has survived unused */
+static inline uint64_t entry_value(const node *e)
+{
+    uint64_t age = entry_age(e);
+    if (age == CACHE_STALE)
+        return 0;
+    uint64_t cost = LEVEL(e->from) + ((e->j & CACHE_TAG) ? 0 : e->j & ~CACHE_PHASE);
+    return cost >> age;
+}
+
+/* The first slot of the bucket (from, j) can be cached in */
+static inline node *cache_bucket(node_table *table, node_id from, uint64_t j)
+{
+    uint64_t hash = hash_quad(from, j, from, j);
+    return &cache_slots(table)[hash & (table->size - 1) & ~(uint64_t)(CACHE_WAYS - 1)];
+}
+
+/* Look for (from, j) in its bucket; on a hit, e holds the entry and *slot
+    (if not NULL) where it is */
+static bool probe_bucket(node_table *table, node_id from, uint64_t j, node *e, node **slot)
+{
+    node *bucket = cache_bucket(table, from, j);
+    for (int k = 0; k < CACHE_WAYS; k++)
+        if (read_entry(table, &bucket[k], e) && UNMARK(e->from) == from && e->j == j)
+        {
+            if (slot)
+                *slot = &bucket[k];
+            return true;
+        }
+    return false;
+}
+
+/* Look up (from, j) in the successor cache: the slots of one bucket,
+    then the same in a fork's parents. A hit makes the entry young again.
 */
 node_id lookup_next(node_table *table, node_id from, uint64_t j)
 {
-    uint64_t mask = (table->size) - 1;
-    uint64_t hash = hash_quad(from, j, from, j);
-    node *n = &table->index[hash & mask];
-    if (n->from == from && n->j == j)
-        return n->to;
-    return UNUSED;
+    node e;
+    node *slot = NULL;
+    bool hit = probe_bucket(table, from, j, &e, &slot);
+    // a fork can use its parents' entries, unless its rule has changed since
+    for (node_table *p = table->parent; !hit && p && ((j & CACHE_TAG) || table->parent_successors); p = p->parent)
+        hit = probe_bucket(p, from, j, &e, NULL);
+    if (!(j & CACHE_TAG)) // only count successors
+    {
+        if (hit)
+        {
+            STAT(table->stats.succ_hits[STATS_BUCKET(LEVEL(from))]++);
+            STAT(table->stats.succ_hits_j[STATS_BUCKET(j & ~CACHE_PHASE)]++);
+        }
+        else
+        {
+            STAT(table->stats.succ_misses[STATS_BUCKET(LEVEL(from))]++);
+            STAT(table->stats.succ_misses_j[STATS_BUCKET(j & ~CACHE_PHASE)]++);
+        }
+    }
+    // a shared table's readers never write; its entries just age out sooner
+    if (slot && !table->shared && entry_age(&e))
+        set_age(slot, 0);
+    return hit ? UNMARK(e.to) : UNUSED;
 }
 
-/* Cache the successor result,
-    kicking out any existing entry.
+/* Cache the successor result in its bucket: over an older entry for the
+    same key, else in an empty slot, else over the entry worth less (see
+    entry_value()), and the one kept grows older.
 */
 void cache_next(node_table *table, node_id from, node_id to, uint64_t j)
 {
-    uint64_t mask = (table->size) - 1;
-    uint64_t hash = hash_quad(from, j, from, j);
-    node *n = &table->index[hash & mask];
+    if (to == UNUSED) // the table was full: nothing to remember
+        return;
+    node *bucket = cache_bucket(table, from, j);
+    uint64_t *seq = cache_seq(table, bucket), s = 0;
+    if (seq)
+    {
+        // another process is writing this stripe: skip, it is only a cache
+        s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+        if ((s & 1) || !__atomic_compare_exchange_n(seq, &s, s + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    node *n = NULL;
+    for (int k = 0; k < CACHE_WAYS && !n; k++)
+        if (UNMARK(bucket[k].from) == from && bucket[k].j == j)
+            n = &bucket[k];
+    for (int k = 0; k < CACHE_WAYS && !n; k++)
+        if (bucket[k].from == UNUSED)
+            n = &bucket[k];
+    if (!n)
+    {
+        // a contest: the entry worth less goes (the newer one, on a tie)
+        n = entry_value(&bucket[0]) < entry_value(&bucket[1]) ? &bucket[0] : &bucket[1];
+        node *kept = n == &bucket[0] ? &bucket[1] : &bucket[0];
+        uint64_t age = entry_age(kept);
+        set_age(kept, age < CACHE_STALE ? age + 1 : age);
+        if (!(kept->j & CACHE_TAG))
+        {
+            STAT(table->stats.succ_kept[STATS_BUCKET(LEVEL(kept->from))]++);
+            STAT(table->stats.succ_kept_j[STATS_BUCKET(kept->j & ~CACHE_PHASE)]++);
+        }
+        if (!(n->j & CACHE_TAG))
+        {
+            STAT(table->stats.succ_overwrites[STATS_BUCKET(LEVEL(n->from))]++);
+            STAT(table->stats.succ_overwrites_j[STATS_BUCKET(n->j & ~CACHE_PHASE)]++);
+        }
+    }
     n->from = from;
     n->to = to;
     n->j = j;
+    if (seq)
+        __atomic_store_n(seq, s + 2, __ATOMIC_RELEASE);
 }
 
 /* Centre a node, by surrounding it with zeros of the same size.
@@ -64,6 +199,8 @@ void cache_next(node_table *table, node_id from, node_id to, uint64_t j)
 node_id centre(node_table *table, node_id m_h)
 {
     node_id z;
+    if (m_h == UNUSED)
+        return UNUSED;
     node m = *lookup(table, m_h);
     z = get_zero(table, LEVEL(m_h) - 1);
     node_id a = join(table, z, z, z, m.a);
@@ -82,16 +219,87 @@ node_id get_zero(node_table *table, uint64_t k)
     node_id z = (0ULL << 63) | (1ULL << 62) | (k << 46) | (HASH_MASK(mix64(k)));
     if (lookup(table, z)->id == z)
         return z;
-    return join(table, get_zero(table, k - 1), get_zero(table, k - 1), get_zero(table, k - 1), get_zero(table, k - 1));
+    z = get_zero(table, k - 1);
+    return join(table, z, z, z, z);
 }
 
-node *lookup(node_table *table, node_id id)
+/* lookup_own() for a shared table: waits out slots that another process
+    is still filling in */
+static node *lookup_shared(node_table *table, node_id id)
+{
+    uint64_t mask = table->size - 1;
+    for (uint64_t index = id;; index++)
+    {
+        node *n = &table->index[index & mask];
+        node_id found;
+        while ((found = __atomic_load_n(&n->id, __ATOMIC_ACQUIRE)) == SHARED_BUSY)
+            shared_wait();
+        if (found == UNUSED || found == id)
+            return n;
+    }
+}
+
+/* The directory entry for id in an arena table, or the empty one it would go in */
+static dir_entry *dir_probe(node_table *table, node_id id)
 {
+    uint64_t mask = table->size - 1;
+    uint64_t index = id;
+    dir_entry *e = &table->dir[index & mask];
+#if HL_STATS
+    uint64_t probes = 0;
+    while (e->id != UNUSED && e->id != id)
+    {
+        e = &table->dir[++index & mask];
+        probes++;
+    }
+    table->stats.probe_hist[probes < STATS_PROBES ? probes : STATS_PROBES - 1]++;
+#else
+    while (e->id != UNUSED && e->id != id)
+        e = &table->dir[++index & mask];
+#endif
+    return e;
+}
+
+/* Find id in this table's own index, or the empty slot it would go in
+    (for an arena table, the first free one) */
+static node *lookup_own(node_table *table, node_id id)
+{
+    if (table->shared)
+        return lookup_shared(table, id);
+    if (table->dir)
+    {
+        dir_entry *e = dir_probe(table, id);
+        return &table->index[e->id == id ? e->pos : table->count];
+    }
     uint64_t mask = table->size - 1;
     uint64_t index = id;
     node *n = &table->index[index & mask];
+#if HL_STATS
+    uint64_t probes = 0;
+    while (n->id != UNUSED && n->id != id)
+    {
+        n = &table->index[++index & mask];
+        probes++;
+    }
+    table->stats.probe_hist[probes < STATS_PROBES ? probes : STATS_PROBES - 1]++;
+#else
     while (n->id != UNUSED && n->id != id)
-        n = &table->index[index++ & mask];
+        n = &table->index[++index & mask];
+#endif
+    return n;
+}
+
+/* Find id, falling through to the parents of a fork; if it is nowhere,
+    return the empty slot in this table's own index where it would go */
+node *lookup(node_table *table, node_id id)
+{
+    node *n = lookup_own(table, id);
+    for (node_table *p = table->parent; n->id == UNUSED && p; p = p->parent)
+    {
+        node *found = lookup_own(p, id);
+        if (found->id == id)
+            return found;
+    }
     return n;
 }
 
@@ -99,22 +307,116 @@ node *lookup(node_table *table, node_id id)
 /* Duplicate a table */
 node_table *copy_table(node_table *old_table)
 {
-    node_table *new_table = create_table(old_table->size);
+    node_table *new_table = create_table_alloc(old_table->size, old_table->alloc_flags);
     memcpy(new_table->index, old_table->index, old_table->size * sizeof(node));
-    new_table->count = old_table->count;    
+    if (old_table->dir)
+    {
+        memcpy(new_table->dir, old_table->dir, old_table->size * sizeof(dir_entry));
+        memcpy(new_table->cache, old_table->cache, old_table->size * sizeof(node));
+    }
+    new_table->count = old_table->count;
+    new_table->layout = old_table->layout;
+    new_table->symmetry_level = old_table->symmetry_level;
+    new_table->rule = old_table->rule;
+    new_table->parent = old_table->parent;
+    new_table->parent_successors = old_table->parent_successors;
     return new_table;
 }
 
+/* Are all of a table's successors (and its parents') computed under rule? */
+static bool shares_successors(node_table *table, const life_rule *rule)
+{
+    return !memcmp(table->rule.phase, rule->phase, sizeof(rule->phase)) &&
+           (!table->parent || table->parent_successors);
+}
+
+/* Fork a table: the fork reads every node and cache entry of the parent,
+    but stores new ones only in its own (initially small) index, so a fork
+    costs nothing to make and one free_table() to throw away. The parent
+    is shared, not copied: it must not be changed (or freed) while it has
+    forks. Forks of forks fall through each layer in turn.
+*/
+node_table *fork_table(node_table *parent, uint64_t initial_size)
+{
+    node_table *table = create_table_alloc(initial_size, parent->alloc_flags);
+    table->symmetry_level = parent->symmetry_level;
+    table->rule = parent->rule;
+    table->parent = parent;
+    table->parent_successors = shares_successors(parent, &parent->rule);
+    return table;
+}
+
+/* Point an arena node at its children (as found by lookup()), if they are
+    all in the same arena, at positions that fit in 32 bits */
+static void link_children(node_table *table, node *n, node *const children[4])
+{
+    node_id ids[4] = {n->a, n->b, n->c, n->d};
+    uint64_t pos[4];
+    n->from = n->to = n->j = 0;
+    for (int q = 0; q < 4; q++)
+    {
+        if (LEVEL(n->id) == 0 || children[q] < table->index || children[q] >= table->index + table->count ||
+            UNMARK(children[q]->id) != ids[q])
+            return;
+        pos[q] = (uint64_t)(children[q] - table->index);
+        if (pos[q] >> 32) // too far in to link: left for lookup()
+            return;
+    }
+    n->from = pos[0] | pos[1] << 32;
+    n->to = pos[2] | pos[3] << 32;
+    n->j = ARENA_LINKED;
+}
+
+/* Child q (0 to 3 for a to d) of n, which lookup() returned: straight
+    through its link if it is a linked arena node, else looked up */
+static inline node *child(node_table *table, node *n, int q)
+{
+    for (node_table *t = table; t && t->dir; t = t->parent)
+        if (n >= t->index && n < t->index + t->count)
+        {
+            if (n->j == ARENA_LINKED)
+                return &t->index[((q < 2 ? n->from : n->to) >> (32 * (q & 1))) & 0xFFFFFFFFULL];
+            break;
+        }
+    node_id ids[4] = {n->a, n->b, n->c, n->d};
+    return lookup(table, ids[q]);
+}
+
+/* (Re)make an arena table's directory, for its size and the nodes in its index */
+static void rebuild_dir(node_table *table)
+{
+    table_mem_free(&table->dir_mem);
+    table->dir = (dir_entry *)table_mem_alloc(&table->dir_mem, table->size * sizeof(dir_entry), table->alloc_flags);
+    for (uint64_t i = 0; i < table->count; i++)
+        *dir_probe(table, table->index[i].id) = (dir_entry){.id = table->index[i].id, .pos = i};
+}
+
 /* Double the size of the table, reinserting nodes */
 void resize_table(node_table *table)
 {
+#if HL_STATS
+    uint64_t t0 = now_ns();
+#endif
+    TRACE_BEGIN(t1, true);
     uint64_t new_size = table->size * 2;
-    node *new_index = (node *)calloc(new_size, sizeof(node));
+    table_mem new_mem;
+    node *new_index = (node *)table_mem_alloc(&new_mem, new_size * sizeof(node), table->alloc_flags);
     uint64_t new_mask = new_size - 1;
     uint64_t new_index_pos;
     node *old_n;
 
-    for (uint64_t i = 0; i < table->size; i++)
+    // an arena keeps every node (and cache entry) where it is; only the directory is rebuilt
+    if (table->dir)
+    {
+        memcpy(new_index, table->index, table->size * sizeof(node));
+        table_mem new_cache_mem;
+        node *new_cache = (node *)table_mem_alloc(&new_cache_mem, new_size * sizeof(node), table->alloc_flags);
+        memcpy(new_cache, table->cache, table->size * sizeof(node));
+        table_mem_free(&table->cache_mem);
+        table->cache_mem = new_cache_mem;
+        table->cache = new_cache;
+    }
+    for (uint64_t i = 0; !table->dir && i < table->size; i++)
     {
         old_n = &table->index[i];
         // perform re-insertion of all nodes
@@ -126,9 +428,17 @@ void resize_table(node_table *table)
             new_index[new_index_pos] = *old_n;
         }
     }
-    free(table->index);
+    table_mem_free(&table->mem);
+    table->mem = new_mem;
     table->index = new_index;
     table->size = new_size;
+    if (table->dir)
+        rebuild_dir(table);
+    TRACE_END(t1, "resize_table", 0, "size", new_size);
+#if HL_STATS
+    table->stats.resizes++;
+    table->stats.resize_ns += now_ns() - t0;
+#endif
 }
 
 /* Given four node_ids, compute the parent node ID */
@@ -145,40 +455,96 @@ uint64_t merge(node_id a, node_id b, node_id c, node_id d)
         return (0ULL << 63) | (0ULL << 62) | (level << 46) | (HASH_MASK(h));
 }
 
+/* Total population of four nodes */
+static uint64_t children_pop(node_table *table, node_id a_hash, node_id b_hash, node_id c_hash, node_id d_hash)
+{
+    return lookup(table, a_hash)->pop + lookup(table, b_hash)->pop + lookup(table, c_hash)->pop +
+           lookup(table, d_hash)->pop;
+}
+
 /* Join four nodes.
    - If the node exists, return it from the table.
    - Otherwise, intern it.
    - Increment the reference counts of the child nodes.
-   - Returns the hash of the joined node.
+   - Returns the hash of the joined node, or UNUSED if a child is UNUSED
+     or a shared table is too full to take another node.
 */
 
 node_id join(node_table *table, node_id a_hash, node_id b_hash, node_id c_hash, node_id d_hash)
 {
+    if (a_hash == UNUSED || b_hash == UNUSED || c_hash == UNUSED || d_hash == UNUSED)
+        return UNUSED; // a join that failed below fails all the way up
     uint64_t hash = merge(a_hash, b_hash, c_hash, d_hash);
-    node *n = lookup(table, hash);
-    while (n->id != UNUSED)
+    uint64_t pop = 0;
+    node *n;
+    for (;;)
     {
-        if (n->a == a_hash && n->b == b_hash && n->c == c_hash && n->d == d_hash)
-            return n->id;                // found it
-        uint64_t new_hash = mix64(hash); // doppleganger, create a new unique id
-        hash ^= HASH_MASK(new_hash);     // XOR in low 46 bits only
         n = lookup(table, hash);
+        node_id found;
+        while ((found = __atomic_load_n(&n->id, __ATOMIC_ACQUIRE)) != UNUSED)
+        {
+            if (found == SHARED_BUSY) // another process is still writing it
+            {
+                n = lookup(table, hash);
+                continue;
+            }
+            if (n->a == a_hash && n->b == b_hash && n->c == c_hash && n->d == d_hash)
+            {
+                STAT(table->stats.join_hits++);
+                return found; // found it
+            }
+            STAT(table->stats.doppelgangers++);
+            uint64_t new_hash = mix64(hash); // doppleganger, create a new unique id
+            hash ^= HASH_MASK(new_hash);     // XOR in low 46 bits only
+            n = lookup(table, hash);
+        }
+        if (!table->shared)
+            break;
+        // past SHARED_MAX_LOAD advance_poll() returns ADVANCE_FULL, for the caller to vacuum;
+        // fail instead of taking one of the last 1/SHARED_HARD_LOAD slots, which keep the probes short
+        if ((table->size - 1 - __atomic_load_n(&table->shared->count, __ATOMIC_RELAXED)) * SHARED_HARD_LOAD <
+            table->size)
+            return UNUSED;
+        // in a shared table, claim the slot, or look again if another process got there first;
+        // nothing may be looked up while a slot is claimed, so count the population before
+        node_id empty = UNUSED;
+        pop = children_pop(table, a_hash, b_hash, c_hash, d_hash);
+        if (__atomic_compare_exchange_n(&n->id, &empty, SHARED_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
     }
 
     // not found, so create it
-    n->id = hash;
+    STAT(table->stats.join_misses++);
+    node *children[4] = {NULL};
+    if (table->dir)
+    {
+        // an arena node links to its children, so keep them from counting the population
+        node_id ids[4] = {a_hash, b_hash, c_hash, d_hash};
+        pop = 0;
+        for (int q = 0; q < 4; q++)
+            pop += (children[q] = lookup(table, ids[q]))->pop;
+    }
+    else if (!table->shared)
+        pop = children_pop(table, a_hash, b_hash, c_hash, d_hash);
 
     // set children
     n->a = a_hash;
     n->b = b_hash;
     n->c = c_hash;
     n->d = d_hash;
-    // set population
-    node *a = lookup(table, a_hash);
-    node *b = lookup(table, b_hash);
-    node *c = lookup(table, c_hash);
-    node *d = lookup(table, d_hash);
-    n->pop = a->pop + b->pop + c->pop + d->pop;
+    n->pop = pop;
+    if (table->shared)
+    {
+        __atomic_store_n(&n->id, hash, __ATOMIC_RELEASE);
+        table->count = __atomic_add_fetch(&table->shared->count, 1, __ATOMIC_RELAXED);
+        return hash;
+    }
+    n->id = hash;
+    if (table->dir)
+    {
+        link_children(table, n, children);
+        *dir_probe(table, hash) = (dir_entry){.id = hash, .pos = (uint64_t)(n - table->index)};
+    }
     table->count++;
 
     // resize the table if necessary
@@ -187,31 +553,151 @@ node_id join(node_table *table, node_id a_hash, node_id b_hash, node_id c_hash,
     return hash;
 }
 
+/* Return id under one of the eight symmetries of the square:
+    bit 2 swaps x and y, then bit 0 flips x and bit 1 flips y.
+    Memoised in the successor cache (CACHE_TRANSFORM) above level 2.
+*/
+node_id transform(node_table *table, node_id id, int t)
+{
+    if (t == 0 || LEVEL(id) == 0 || IS_ZERO(id))
+        return id;
+    node_id cached = UNUSED;
+    if (LEVEL(id) > 2 && (cached = lookup_next(table, id, CACHE_TRANSFORM | t)) != UNUSED)
+        return cached;
+    node n = *lookup(table, id);
+    node_id old[4] = {n.a, n.b, n.c, n.d}, new[4];
+    // quadrant (qx, qy) moves by the same symmetry of the 2x2 square
+    for (int q = 0; q < 4; q++)
+    {
+        int qx = q & 1, qy = q >> 1;
+        if (t & 4)
+        {
+            int s = qx;
+            qx = qy, qy = s;
+        }
+        qx ^= t & 1;
+        qy ^= (t >> 1) & 1;
+        new[qy * 2 + qx] = transform(table, old[q], t);
+    }
+    node_id result = join(table, new[0], new[1], new[2], new[3]);
+    if (LEVEL(id) > 2)
+        cache_next(table, id, result, CACHE_TRANSFORM | t);
+    return result;
+}
+
+/* Join four nodes only if the result is already interned; otherwise UNUSED */
+static node_id find_join(node_table *table, node_id a, node_id b, node_id c, node_id d)
+{
+    uint64_t hash = merge(a, b, c, d);
+    node *n = lookup(table, hash);
+    while (n->id != UNUSED)
+    {
+        if (n->a == a && n->b == b && n->c == c && n->d == d)
+            return n->id;
+        hash ^= HASH_MASK(mix64(hash));
+        n = lookup(table, hash);
+    }
+    return UNUSED;
+}
+
+/* As transform(), but only if the transformed node already exists; otherwise UNUSED */
+node_id find_transform(node_table *table, node_id id, int t)
+{
+    if (t == 0 || LEVEL(id) == 0 || IS_ZERO(id))
+        return id;
+    node_id cached = UNUSED;
+    if (LEVEL(id) > 2 && (cached = lookup_next(table, id, CACHE_TRANSFORM | t)) != UNUSED)
+        return cached;
+    node n = *lookup(table, id);
+    node_id old[4] = {n.a, n.b, n.c, n.d}, new[4];
+    for (int q = 0; q < 4; q++)
+    {
+        int qx = q & 1, qy = q >> 1;
+        if (t & 4)
+        {
+            int s = qx;
+            qx = qy, qy = s;
+        }
+        qx ^= t & 1;
+        qy ^= (t >> 1) & 1;
+        if ((new[qy * 2 + qx] = find_transform(table, old[q], t)) == UNUSED)
+            return UNUSED;
+    }
+    node_id result = find_join(table, new[0], new[1], new[2], new[3]);
+    if (result != UNUSED && LEVEL(id) > 2)
+        cache_next(table, id, result, CACHE_TRANSFORM | t);
+    return result;
+}
+
+/* The symmetry that undoes transform t */
+int inverse_transform(int t)
+{
+    // flips before a swap become the other flip after it
+    return (t & 4) ? 4 | ((t & 1) << 1) | ((t & 2) >> 1) : t;
+}
+
+/* Share successors of nodes at min_level and above between all eight
+    orientations of each node (0 turns it off). Only valid for isotropic rules. */
+void set_symmetry(node_table *table, uint64_t min_level)
+{
+    table->symmetry_level = min_level ? (min_level < 3 ? 3 : min_level) : 0;
+}
+
 static inline node_id sucjoin(node_table *table, node_id a, node_id b, node_id c, node_id d, uint64_t j)
 {
-    return successor(table, join(table, a, b, c, d), j);
+    return successor_exact(table, join(table, a, b, c, d), j);
 }
 
-/* Find the successor of the given node, 2^level-2 steps in the future */
+/* Find the successor of the given node, 2^level-2 steps in the future,
+    or 2^j steps if 0 < j < level-2 (j may have CACHE_PHASE, as below) */
 node_id successor(node_table *table, node_id id, uint64_t j)
 {
+    return successor_exact(table, id, (j & ~CACHE_PHASE) == 0 ? (LEVEL(id) - 2) | j : j);
+}
 
+/* Find the centre of the given node exactly 2^j steps in the future
+    (j = 0 is a single generation); j is limited to level-2. Under an
+    alternating (B0) rule, j | CACHE_PHASE starts at an odd generation.
+    Returns UNUSED if a shared table fills up (see join()).
+*/
+node_id successor_exact(node_table *table, node_id id, uint64_t j)
+{
+    if (id == UNUSED)
+        return UNUSED;
     uint64_t level = LEVEL(id);
+    bool odd = (j & CACHE_PHASE) && table->rule.alternating;
+    j &= ~CACHE_PHASE;
 
-    if (j == 0 || j >= level - 2)
+    if (j >= level - 2)
         j = level - 2;
+    // the cache key; children start in the same phase
+    uint64_t key = odd ? j | CACHE_PHASE : j;
 
     if (IS_ZERO(id)) // empty
         return lookup(table, id)->a;
 
-    node_id next = lookup_next(table, id, j);
+    node_id next = lookup_next(table, id, key);
     if (next != UNUSED)
         return next;
 
+    // if another orientation of this node already has its successor, turn that round
+    if (table->symmetry_level && level >= table->symmetry_level)
+        for (int t = 1; t < 8; t++)
+        {
+            node_id other = find_transform(table, id, t);
+            if (other == UNUSED || other == id || (next = lookup_next(table, other, key)) == UNUSED)
+                continue;
+            next = transform(table, next, inverse_transform(t));
+            cache_next(table, id, next, key);
+            return next;
+        }
+
+    TRACE_BEGIN(t0, level >= trace_min_level);
     if (level == 2) // base case
     {
-        next = life_4x4(table, id);
-        cache_next(table, id, next, j);
+        next = life_4x4(table, id, odd);
+        cache_next(table, id, next, key);
+        TRACE_END(t0, "successor", level, "j", j);
         return next;
     }
 
@@ -219,24 +705,27 @@ node_id successor(node_table *table, node_id id, uint64_t j)
 
     node_id c1, c2, c3, c4, c5, c6, c7, c8, c9;
     // copy the actual nodes to prevent changes during lookups
-    node a = *lookup(table, n->a);
-    node b = *lookup(table, n->b);
-    node c = *lookup(table, n->c);
-    node d = *lookup(table, n->d);
+    node a = *child(table, n, 0);
+    node b = *child(table, n, 1);
+    node c = *child(table, n, 2);
+    node d = *child(table, n, 3);
 
-    c1 = successor(table, a.id, j); // same as sucjoin(table, a.a, a.b, a.c, a.d, j);
-    c2 = sucjoin(table, a.b, b.a, a.d, b.c, j);
-    c3 = successor(table, b.id, j);
-    c4 = sucjoin(table, a.c, a.d, c.a, c.b, j);
-    c5 = sucjoin(table, a.d, b.c, c.b, d.a, j);
-    c6 = sucjoin(table, b.c, b.d, d.a, d.b, j);
-    c7 = successor(table, c.id, j);
-    c8 = sucjoin(table, c.b, d.a, c.d, d.c, j);
-    c9 = successor(table, d.id, j);
+    c1 = successor_exact(table, a.id, key); // same as sucjoin(table, a.a, a.b, a.c, a.d, key);
+    c2 = sucjoin(table, a.b, b.a, a.d, b.c, key);
+    c3 = successor_exact(table, b.id, key);
+    c4 = sucjoin(table, a.c, a.d, c.a, c.b, key);
+    c5 = sucjoin(table, a.d, b.c, c.b, d.a, key);
+    c6 = sucjoin(table, b.c, b.d, d.a, d.b, key);
+    c7 = successor_exact(table, c.id, key);
+    c8 = sucjoin(table, c.b, d.a, c.d, d.c, key);
+    c9 = successor_exact(table, d.id, key);
 
     /* Not the natural successor; combine parts */
     if (j < level - 2)
     {
+        if (c1 == UNUSED || c2 == UNUSED || c3 == UNUSED || c4 == UNUSED || c5 == UNUSED ||
+            c6 == UNUSED || c7 == UNUSED || c8 == UNUSED || c9 == UNUSED)
+            return UNUSED; // a shared table filled up
         node c1n = *lookup(table, c1);
         node c2n = *lookup(table, c2);
         node c3n = *lookup(table, c3);
@@ -252,57 +741,589 @@ node_id successor(node_table *table, node_id id, uint64_t j)
                     join(table, c2n.d, c3n.c, c5n.b, c6n.a),
                     join(table, c4n.d, c5n.c, c7n.b, c8n.a),
                     join(table, c5n.d, c6n.c, c8n.b, c9n.a));
-        cache_next(table, id, next, j);
+        cache_next(table, id, next, key);
+        TRACE_END(t0, "successor", level, "j", j);
         return next;
     }
     else
     {
-        /* Natural successor */
+        /* Natural successor; the second half starts 2^(j-1) generations later */
+        uint64_t key2 = (level == 3 && table->rule.alternating) ? key ^ CACHE_PHASE : key;
         next = join(table,
-                    sucjoin(table, c1, c2, c4, c5, j),
-                    sucjoin(table, c2, c3, c5, c6, j),
-                    sucjoin(table, c4, c5, c7, c8, j),
-                    sucjoin(table, c5, c6, c8, c9, j));
+                    sucjoin(table, c1, c2, c4, c5, key2),
+                    sucjoin(table, c2, c3, c5, c6, key2),
+                    sucjoin(table, c4, c5, c7, c8, key2),
+                    sucjoin(table, c5, c6, c8, c9, key2));
 
-        cache_next(table, id, next, j);
+        cache_next(table, id, next, key);
+        TRACE_END(t0, "successor", level, "j", j);
         return next;
     }
 }
 
-/* Advance time by j steps.
-    - Find the MSB of j
-    - Make sure that the node has a level at least big enough
+/* Start a resumable advance of id by the given number of generations */
+void advance_begin(node_table *table, advance_state *state, node_id id, uint64_t steps)
+{
+    state->root = id;
+    state->remaining = steps;
+    state->generations = 0;
+    state->start_count = table->count;
+    state->nodes_created = 0;
+    state->max_j = ADVANCE_MAX_J;
+    state->leap = false;
+    state->cancel = false;
+}
 
+/* Start a resumable fast forward of id by the given number of HashLife leaps */
+void ffwd_begin(node_table *table, advance_state *state, node_id id, uint64_t leaps)
+{
+    advance_begin(table, state, id, leaps);
+    state->leap = true;
+}
+
+/* Do one bounded step of an advance or fast forward. Returns false, with
+    nothing done, if a shared table is too full for the step. */
+static bool advance_step(node_table *table, advance_state *state)
+{
+    TRACE_BEGIN(t0, true);
+    node_id id = state->root;
+    if (state->leap)
+    {
+        // one natural step: the padded node doubles its level every leap
+        id = centre(table, centre(table, pad(table, id)));
+        uint64_t gens = LEVEL(id) - 2 < 64 ? 1ULL << (LEVEL(id) - 2) : UINT64_MAX;
+        id = successor(table, id, state->generations & 1 ? CACHE_PHASE : 0);
+        if (id == UNUSED)
+            return false;
+        state->remaining--;
+        state->generations = gens > UINT64_MAX - state->generations ? UINT64_MAX : state->generations + gens;
+        TRACE_END(t0, "ffwd_step", LEVEL(id), "leap", state->generations);
+    }
+    else
+    {
+        // advance by 2^j on the lowest set bit j, split into leaps of at most 2^max_j
+        uint64_t j = 0;
+        while (!(state->remaining >> j & 1))
+            j++;
+        j = min(j, state->max_j);
+        // the pattern must sit in the centre quarter, with 2^j cells to spare on every side
+        id = pad(table, id);
+        while (LEVEL(id) < j + 2)
+            id = centre(table, id);
+        id = successor_exact(table, centre(table, id), state->generations & 1 ? j | CACHE_PHASE : j);
+        if (id == UNUSED)
+            return false;
+        state->remaining -= 1ULL << j;
+        state->generations += 1ULL << j;
+        TRACE_END(t0, "advance_step", LEVEL(id), "j", j);
+    }
+    state->root = id;
+    state->nodes_created = table->count > state->start_count ? table->count - state->start_count : 0;
+    return true;
+}
+
+/* Continue an advance or fast forward until it finishes, is cancelled, or
+    the deadline (in now_ns() time, 0 for none) passes. At least one step is
+    done per call unless cancelled. Returns ADVANCE_DONE, ADVANCE_RUNNING or
+    ADVANCE_CANCELLED; advance_result() gives the pattern so far either way.
+    A shared table more than 1/SHARED_MAX_LOAD full stops after each step
+    with ADVANCE_FULL: vacuum (pinning state->root) and poll again. If the
+    table has no room left for the next step, ADVANCE_FULL comes back with
+    no step done.
+*/
+int advance_poll(node_table *table, advance_state *state, uint64_t deadline_ns)
+{
+    while (state->remaining > 0)
+    {
+        if (state->cancel)
+            return ADVANCE_CANCELLED;
+        if (!advance_step(table, state))
+            return ADVANCE_FULL;
+        if (state->remaining > 0 && table->shared && table->count * SHARED_MAX_LOAD > table->size)
+            return ADVANCE_FULL;
+        if (state->remaining > 0 && deadline_ns && now_ns() >= deadline_ns)
+            return ADVANCE_RUNNING;
+    }
+    return ADVANCE_DONE;
+}
+
+/* The pattern after the generations completed so far, cropped */
+node_id advance_result(node_table *table, advance_state *state)
+{
+    return crop(table, state->root);
+}
+
+/* Advance time by the given number of steps.
+    - Advance by 2^j on each set bit j of steps
+    - Make sure that the node is big enough (and padded) before each bit
+    Under a B0 rule, id is taken to be at an even generation, and after an
+    odd number of steps the result is stored inverted (see rule.h).
+    Returns UNUSED if a shared table fills up before the steps are done.
 */
 node_id advance(node_table *table, node_id id, uint64_t steps)
 {
-    // ensure the node is big enough; n->level must be > log2(steps)+2
-    while ((1ULL << (LEVEL(id) - 2)) < steps)
-        id = centre(table, id);
-    // pad to the centre
-    id = centre(table, id);
-    // advance by 2^j on each set bit j
-    for (uint64_t j = 1; steps > 0; j++, steps >>= 1)
-        if (steps & 1)
-            id = centre(table, successor(table, id, j));
-    // crop for the caller
-    return crop(table, id);
+    TRACE_BEGIN(t0, true);
+    advance_state state;
+    advance_begin(table, &state, id, steps);
+    state.max_j = 63;
+    // no roots to vacuum with here: carry on while the shared table has room
+    uint64_t left;
+    do
+        left = state.remaining;
+    while (advance_poll(table, &state, 0) == ADVANCE_FULL && state.remaining < left);
+    id = state.remaining ? UNUSED : advance_result(table, &state);
+    TRACE_END(t0, "advance", LEVEL(id), "steps", steps);
+    return id;
 }
 
-/* Fast forward by repeated application of the HashLife step */
+/* Fast forward by repeated application of the HashLife step
+    (UNUSED if a shared table fills up, as for advance()) */
 node_id ffwd(node_table *table, node_id id, uint64_t steps, uint64_t *generations)
 {
-    *generations = 0;
-    for (uint64_t i = 0; i < steps; i++)
+    advance_state state;
+    ffwd_begin(table, &state, id, steps);
+    uint64_t left;
+    do
+        left = state.remaining;
+    while (advance_poll(table, &state, 0) == ADVANCE_FULL && state.remaining < left);
+    *generations = state.generations;
+    return state.remaining ? UNUSED : advance_result(table, &state);
+}
+
+/* Set up a stepper that advances id by a fixed number of generations per step */
+void stepper_init(node_table *table, stepper *st, node_id id, uint64_t step)
+{
+    assert(step > 0);
+    st->step = step;
+    st->generation = 0;
+    st->max_j = 0;
+    while (step >> (st->max_j + 1))
+        st->max_j++;
+    // canonical size: padded, and big enough for the largest leap
+    id = pad(table, id);
+    while (LEVEL(id) < st->max_j + 2)
+        id = centre(table, id);
+    st->root = id;
+}
+
+/* Advance the stepper by one step, returning the new (padded) root.
+    The root keeps its level, so the same successor (and cache entries)
+    is used every step; it only grows when the pattern nears the border.
+*/
+node_id stepper_step(node_table *table, stepper *st)
+{
+    TRACE_BEGIN(t0, true);
+    node_id id = st->root;
+    uint64_t generation = st->generation;
+    for (uint64_t j = 0; j <= st->max_j; j++)
+        if (st->step >> j & 1)
+        {
+            if (!is_padded(table, id))
+                id = centre(table, id);
+            id = successor_exact(table, centre(table, id), generation & 1 ? j | CACHE_PHASE : j);
+            generation += 1ULL << j;
+        }
+    if (!is_padded(table, id))
+        id = centre(table, id);
+    st->root = id;
+    st->generation += st->step;
+    TRACE_END(t0, "stepper_step", LEVEL(id), "generation", st->generation);
+    return id;
+}
+
+/* The current pattern, cropped */
+node_id stepper_pattern(node_table *table, stepper *st)
+{
+    return crop(table, st->root);
+}
+
+/* The lowest (or, if high, highest) x (axis 0) or y (axis 1) of any live
+    cell in id, or -1 if it is empty. Empty quadrants are skipped using pop,
+    so only nodes along the live edge are visited.
+*/
+static int64_t live_edge(node_table *table, node_id id, int axis, bool high)
+{
+    node *n = lookup(table, id);
+    if (n->pop == 0)
+        return -1;
+    if (LEVEL(id) == 0)
+        return 0;
+    int64_t half = 1LL << (LEVEL(id) - 1);
+    // the two quadrants on the near and far side of the axis
+    node_id lo[2] = {n->a, axis ? n->b : n->c};
+    node_id hi[2] = {n->d, axis ? n->c : n->b};
+    node_id *near = high ? hi : lo, *far = high ? lo : hi;
+    int64_t near_offset = high ? half : 0, far_offset = high ? 0 : half;
+    int64_t e0 = live_edge(table, near[0], axis, high);
+    int64_t e1 = live_edge(table, near[1], axis, high);
+    if (e0 < 0 && e1 < 0)
     {
-        id = centre(table, centre(table, pad(table, id)));
-        id = successor(table, id, 0);
-        *generations += 1ULL << (LEVEL(id) - 2);
+        e0 = live_edge(table, far[0], axis, high);
+        e1 = live_edge(table, far[1], axis, high);
+        near_offset = far_offset;
+    }
+    if (e0 < 0 || e1 < 0)
+        return near_offset + (e0 < 0 ? e1 : e0);
+    return near_offset + (high ? (e0 > e1 ? e0 : e1) : (e0 < e1 ? e0 : e1));
+}
+
+/* Bounding box of the live cells of id, inclusive; false if it is empty */
+bool bounding_box(node_table *table, node_id id, int64_t *x0, int64_t *y0, int64_t *x1, int64_t *y1)
+{
+    if (lookup(table, id)->pop == 0)
+        return false;
+    *x0 = live_edge(table, id, 0, false);
+    *y0 = live_edge(table, id, 1, false);
+    *x1 = live_edge(table, id, 0, true);
+    *y1 = live_edge(table, id, 1, true);
+    return true;
+}
+
+/* Population (and, if bbox, bounding box) of id at generations t0, t0+stride, ... <= t1.
+    Writes one sample per generation into out, which must have room for
+    (t1-t0)/stride+1 samples, and returns the number written. All samples
+    share one fixed-step stepper, so successors are reused between them.
+    Boxes are in the coordinates of id (x right, y down from its top left).
+    Under a B0 rule, odd generations count (and box) the stored, inverted
+    cells, as lookup()->pop of advance() would.
+*/
+uint64_t pop_series(node_table *table, node_id id, uint64_t t0, uint64_t t1, uint64_t stride, pop_sample *out, bool bbox)
+{
+    assert(stride > 0 && t1 >= t0);
+    stepper st;
+    int64_t half = 1LL << (LEVEL(id) - 1);
+    if (t0 > 0)
+    {
+        stepper_init(table, &st, id, t0);
+        id = stepper_step(table, &st);
+    }
+    stepper_init(table, &st, id, stride);
+    st.generation = t0; // keeps the phase of a B0 rule
+    uint64_t n = 0;
+    for (uint64_t t = t0;; t += stride)
+    {
+        // the stepper keeps the centre fixed, so only the root size changes
+        node *root = lookup(table, st.root);
+        pop_sample *s = &out[n++];
+        s->generation = t;
+        s->pop = root->pop;
+        s->x0 = s->y0 = s->x1 = s->y1 = 0;
+        if (bbox && bounding_box(table, st.root, &s->x0, &s->y0, &s->x1, &s->y1))
+        {
+            int64_t shift = (1LL << (LEVEL(st.root) - 1)) - half;
+            s->x0 -= shift, s->y0 -= shift, s->x1 -= shift, s->y1 -= shift;
+        }
+        if (t1 - t < stride)
+            break;
+        stepper_step(table, &st);
+    }
+    return n;
+}
+
+/* Return the node of the given level whose top left is at (x,y) in id.
+    The window may lie partly (or wholly) outside id; outside is empty.
+    Unaligned windows are memoised in the successor cache, tagged with
+    CACHE_EXTRACT, so shifting a pattern shares work across its repeated parts.
+*/
+node_id extract(node_table *table, node_id id, int64_t x, int64_t y, uint64_t level)
+{
+    int64_t size = 1LL << LEVEL(id), window = 1LL << level;
+    node *n = lookup(table, id);
+    if (n->pop == 0 || x >= size || y >= size || x + window <= 0 || y + window <= 0)
+        return get_zero(table, level);
+    if (x == 0 && y == 0 && level == LEVEL(id))
+        return id;
+
+    // wholly inside one quadrant: descend
+    int64_t half = size / 2;
+    if (level < LEVEL(id) && x >= 0 && y >= 0 && x + window <= size && y + window <= size)
+    {
+        int qx = x >= half, qy = y >= half;
+        if ((x + window <= half || qx) && (y + window <= half || qy))
+        {
+            node_id q = qy ? (qx ? n->d : n->c) : (qx ? n->b : n->a);
+            return extract(table, q, x - qx * half, y - qy * half, level);
+        }
+    }
+
+    bool memo = x >= 0 && y >= 0 && x < (1LL << 27) && y < (1LL << 27) && level < 64;
+    uint64_t key = CACHE_EXTRACT | ((uint64_t)level << 54) | ((uint64_t)x << 27) | (uint64_t)y;
+    if (memo)
+    {
+        node_id cached = lookup_next(table, id, key);
+        if (cached != UNUSED)
+            return cached;
+    }
+    // otherwise build the window from four windows of half the size
+    int64_t h = window / 2;
+    node_id result = join(table,
+                          extract(table, id, x, y, level - 1),
+                          extract(table, id, x + h, y, level - 1),
+                          extract(table, id, x, y + h, level - 1),
+                          extract(table, id, x + h, y + h, level - 1));
+    if (memo)
+        cache_next(table, id, result, key);
+    return result;
+}
+
+/* Does [x0,x1) x [y0,y1) meet the square of the given size at (x,y)? */
+static inline bool meets(int64_t x, int64_t y, int64_t size, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    return x0 < x + size && x < x1 && y0 < y + size && y < y1;
+}
+
+/* successor_exact(table, id, key), but only right inside [x0,x1) x [y0,y1),
+    in the frame of the result. Subtrees whose light cone misses the region
+    are not computed (they are left empty), so the result is only cached when
+    the region covers all of it.
+*/
+static node_id successor_region(node_table *table, node_id id, uint64_t key, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    uint64_t level = LEVEL(id);
+    int64_t size = 1LL << (level - 1); // of the result
+    if (IS_ZERO(id) || !meets(0, 0, size, x0, y0, x1, y1))
+        return get_zero(table, level - 1);
+    if (level <= 3 || (x0 <= 0 && y0 <= 0 && x1 >= size && y1 >= size))
+        return successor_exact(table, id, key);
+    bool odd = (key & CACHE_PHASE) && table->rule.alternating;
+    uint64_t j = min(key & ~CACHE_PHASE, level - 2);
+    key = odd ? j | CACHE_PHASE : j;
+    node_id next = lookup_next(table, id, key);
+    if (next != UNUSED)
+        return next;
+
+    TRACE_BEGIN(t0, level >= trace_min_level);
+    // the 4x4 grandchildren, and the successor of each of the nine
+    // overlapping children that the region needs
+    node *n = lookup(table, id);
+    node a = *lookup(table, n->a), b = *lookup(table, n->b);
+    node c = *lookup(table, n->c), d = *lookup(table, n->d);
+    node_id g[4][4] = {{a.a, a.b, b.a, b.b}, {a.c, a.d, b.c, b.d}, {c.a, c.b, d.a, d.b}, {c.c, c.d, d.c, d.d}};
+    int64_t quarter = size / 4;
+    bool natural = j == level - 2;
+    int64_t margin = natural ? quarter : 0; // the second half step looks this far out
+    node_id cs[3][3];
+    for (int cy = 0; cy < 3; cy++)
+        for (int cx = 0; cx < 3; cx++)
+        {
+            // each result is the centre of its child, 2 * quarter on a side
+            int64_t ox = (2 * cx - 1) * quarter, oy = (2 * cy - 1) * quarter;
+            if (!meets(ox, oy, 2 * quarter, x0 - margin, y0 - margin, x1 + margin, y1 + margin))
+                cs[cy][cx] = get_zero(table, level - 2);
+            else
+                cs[cy][cx] = successor_region(table, join(table, g[cy][cx], g[cy][cx + 1], g[cy + 1][cx], g[cy + 1][cx + 1]), key,
+                                              x0 - margin - ox, y0 - margin - oy, x1 + margin - ox, y1 + margin - oy);
+        }
+
+    node_id q[2][2];
+    for (int qy = 0; qy < 2; qy++)
+        for (int qx = 0; qx < 2; qx++)
+        {
+            node_id c1 = cs[qy][qx], c2 = cs[qy][qx + 1], c3 = cs[qy + 1][qx], c4 = cs[qy + 1][qx + 1];
+            if (natural) // the second half step, from the first half's results
+                q[qy][qx] = successor_region(table, join(table, c1, c2, c3, c4), key,
+                                             x0 - qx * 2 * quarter, y0 - qy * 2 * quarter, x1 - qx * 2 * quarter, y1 - qy * 2 * quarter);
+            else // the inner corners of the four results
+                q[qy][qx] = join(table, lookup(table, c1)->d, lookup(table, c2)->c, lookup(table, c3)->b, lookup(table, c4)->a);
+        }
+    next = join(table, q[0][0], q[0][1], q[1][0], q[1][1]);
+    TRACE_END(t0, "successor_region", level, "j", j);
+    return next;
+}
+
+/* The pattern in a w x h window at (x,y) of id (in id's frame), steps
+    generations on: returns the node of the smallest level covering the
+    window, with its top left at (x,y), as extract() would give from the
+    full universe. Only the successors whose light cone meets the window
+    are computed, so the work follows the window, not the universe; cells
+    outside the window are not reliable. As advance(), a B0 result after
+    an odd number of steps is stored inverted. Returns UNUSED for more
+    than REGION_MAX_STEPS steps, whose light cone would not fit in the
+    int64_t frame.
+*/
+node_id advance_region(node_table *table, node_id id, uint64_t steps, int64_t x, int64_t y, uint64_t w, uint64_t h)
+{
+    if (steps > REGION_MAX_STEPS)
+        return UNUSED;
+    TRACE_BEGIN(t0, true);
+    uint64_t level = 1;
+    while ((1ULL << level) < w || (1ULL << level) < h)
+        level++;
+    int64_t ox = 0, oy = 0; // the top left of id in the original frame
+    uint64_t generation = 0;
+    while (generation < steps)
+    {
+        uint64_t j = 0;
+        while (!((steps - generation) >> j & 1))
+            j++;
+        // after this step the region must be right as far out as the light cone of the steps still to come
+        uint64_t after = steps - generation - (1ULL << j); // below REGION_MAX_STEPS
+        int64_t x0 = x - (int64_t)after, y0 = y - (int64_t)after;
+        int64_t x1 = x + (int64_t)(w + after), y1 = y + (int64_t)(h + after);
+        // grow until the result (the centre half) covers that, with room for 2^j generations
+        while (LEVEL(id) < j + 2 || !(ox + (1LL << (LEVEL(id) - 2)) <= x0 && oy + (1LL << (LEVEL(id) - 2)) <= y0 &&
+                                       ox + 3 * (1LL << (LEVEL(id) - 2)) >= x1 && oy + 3 * (1LL << (LEVEL(id) - 2)) >= y1))
+        {
+            ox -= 1LL << (LEVEL(id) - 1);
+            oy -= 1LL << (LEVEL(id) - 1);
+            id = centre(table, id);
+        }
+        ox += 1LL << (LEVEL(id) - 2);
+        oy += 1LL << (LEVEL(id) - 2);
+        id = successor_region(table, id, generation & 1 ? j | CACHE_PHASE : j, x0 - ox, y0 - oy, x1 - ox, y1 - oy);
+        generation += 1ULL << j;
+    }
+    id = extract(table, id, x - ox, y - oy, level);
+    TRACE_END(t0, "advance_region", level, "steps", steps);
+    return id;
+}
+
+/* Start iterating over the live cells of id, with its top left at (x, y) */
+void cell_iter_init(node_table *table, cell_iter *it, node_id id, int64_t x, int64_t y)
+{
+    it->table = table;
+    it->x0 = it->y0 = INT64_MIN;
+    it->x1 = it->y1 = INT64_MAX;
+    it->depth = 0;
+    if (lookup(table, id)->pop > 0)
+    {
+        it->stack[0].id = id;
+        it->stack[0].x = x;
+        it->stack[0].y = y;
+        it->stack[0].pos = UINT64_MAX;
+        it->depth = 1;
+    }
+}
+
+/* Only report cells in [x0,x1) x [y0,y1) */
+void cell_iter_clip(cell_iter *it, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    it->x0 = x0, it->y0 = y0, it->x1 = x1, it->y1 = y1;
+}
+
+/* Write up to max live cells into xy, as x, y pairs, returning how many
+    were written; 0 once every cell has been reported. Cells come in
+    quadtree (Z) order.
+*/
+uint64_t cell_iter_next(cell_iter *it, int64_t *xy, uint64_t max)
+{
+    uint64_t n = 0;
+    while (it->depth > 0 && n < max)
+    {
+        node_id id = it->stack[--it->depth].id;
+        int64_t x = it->stack[it->depth].x, y = it->stack[it->depth].y;
+        if (LEVEL(id) == 0) // a root, or a cell left over when the buffer filled
+        {
+            if (x >= it->x0 && x < it->x1 && y >= it->y0 && y < it->y1)
+                xy[2 * n] = x, xy[2 * n + 1] = y, n++;
+            continue;
+        }
+        uint64_t pos = it->stack[it->depth].pos;
+        node *nd = pos < it->table->size && it->table->index[pos].id == id ? &it->table->index[pos]
+                                                                              : lookup(it->table, id);
+        node_id children[4] = {nd->a, nd->b, nd->c, nd->d};
+        int64_t half = 1LL << (LEVEL(id) - 1);
+        if (LEVEL(id) == 1 && max - n >= 4)
+        {
+            // children are cells: report them straight away
+            for (int q = 0; q < 4; q++)
+            {
+                int64_t cx = x + (q & 1), cy = y + (q >> 1);
+                if (children[q] == it->table->on && cx >= it->x0 && cx < it->x1 && cy >= it->y0 && cy < it->y1)
+                    xy[2 * n] = cx, xy[2 * n + 1] = cy, n++;
+            }
+            continue;
+        }
+        // push in reverse, so the top left comes off first
+        for (int q = 3; q >= 0; q--)
+        {
+            int64_t cx = x + (q & 1) * half, cy = y + (q >> 1) * half;
+            node *c = child(it->table, nd, q);
+            if (c->pop == 0 || cx >= it->x1 || cy >= it->y1 || cx + half <= it->x0 || cy + half <= it->y0)
+                continue;
+            node *own = it->table->index;
+            it->stack[it->depth].pos = c >= own && c < own + it->table->size ? (uint64_t)(c - own) : UINT64_MAX;
+            it->stack[it->depth].id = children[q];
+            it->stack[it->depth].x = cx;
+            it->stack[it->depth++].y = cy;
+        }
     }
-    return crop(table, id);
+    return n;
 }
 
-/* Compute the life rule on the 3x3 neighbourhood
+/* Walk two nodes of the same frame in parallel, skipping equal subtrees */
+static uint64_t diff_walk(node_table *table, node_id a, node_id b, int64_t x, int64_t y, uint64_t level,
+                          uint64_t tile_level, diff_callback emit, void *ctx)
+{
+    if (a == b)
+        return 0;
+    if (level == tile_level)
+    {
+        if (emit)
+            emit(ctx, x, y, level, a, b);
+        return 1;
+    }
+    node na = *lookup(table, a), nb = *lookup(table, b);
+    int64_t h = 1LL << (level - 1);
+    return diff_walk(table, na.a, nb.a, x, y, level - 1, tile_level, emit, ctx) +
+           diff_walk(table, na.b, nb.b, x + h, y, level - 1, tile_level, emit, ctx) +
+           diff_walk(table, na.c, nb.c, x, y + h, level - 1, tile_level, emit, ctx) +
+           diff_walk(table, na.d, nb.d, x + h, y + h, level - 1, tile_level, emit, ctx);
+}
+
+/* Report what changed between a (with its top left at (ax, ay)) and b (at
+    (bx, by)): emit is called (if not NULL) for each tile of 2^tile_level
+    cells on a side, aligned to multiples of its size, that differs, with
+    the tile from each. tile_level 0 gives single cell flips. Returns the
+    number of changed tiles.
+    Both are first extract()ed to one common frame, which is free when they
+    already share it (e.g. successive stepper roots). The walk then skips
+    every subtree whose IDs match, so it costs in proportion to the change.
+*/
+uint64_t diff(node_table *table, node_id a, int64_t ax, int64_t ay, node_id b, int64_t bx, int64_t by,
+              uint64_t tile_level, diff_callback emit, void *ctx)
+{
+    int64_t tile = 1LL << tile_level;
+    int64_t x0 = min(ax, bx) & ~(tile - 1), y0 = min(ay, by) & ~(tile - 1);
+    int64_t x1 = ax + (1LL << LEVEL(a)), y1 = ay + (1LL << LEVEL(a));
+    x1 = x1 < bx + (1LL << LEVEL(b)) ? bx + (1LL << LEVEL(b)) : x1;
+    y1 = y1 < by + (1LL << LEVEL(b)) ? by + (1LL << LEVEL(b)) : y1;
+    uint64_t level = tile_level;
+    while (x0 + (1LL << level) < x1 || y0 + (1LL << level) < y1)
+        level++;
+    node_id fa = extract(table, a, x0 - ax, y0 - ay, level);
+    node_id fb = extract(table, b, x0 - bx, y0 - by, level);
+    return diff_walk(table, fa, fb, x0, y0, level, tile_level, emit, ctx);
+}
+
+/* Switch the table to another rule; returns -1 (and changes nothing) if
+    the rule is invalid, or if the table is shared and the rule differs.
+    Cached successors belong to the old rule, so they are flushed; nodes,
+    and other cache entries, stay.
+*/
+int set_rule(node_table *table, const char *text)
+{
+    life_rule rule;
+    if (parse_rule(text, &rule))
+        return -1;
+    if (table->shared && memcmp(rule.phase, table->rule.phase, sizeof(rule.phase)))
+        return -1; // fixed when the shared table was created
+    if (memcmp(rule.phase, table->rule.phase, sizeof(rule.phase)))
+        for (uint64_t i = 0; i < table->size; i++)
+        {
+            node *n = &cache_slots(table)[i];
+            if (n->from != UNUSED && !(n->j & CACHE_TAG))
+                n->from = n->to = UNUSED, n->j = 0;
+        }
+    table->rule = rule;
+    // a fork only reads its parents' successors while they share its rule
+    if (table->parent)
+        table->parent_successors = shares_successors(table->parent, &rule);
+    return 0;
+}
+
+/* Compute the standard B3/S23 life rule on the 3x3 neighbourhood
+    (life_4x4() uses the table's own rule instead)
 
     a b c
     d E f
@@ -317,20 +1338,30 @@ node_id base_life(node_id a, node_id b, node_id c, node_id d, node_id e, node_id
     return (pop_sum == 3 || (pop_sum == 2 && e == ON)) ? ON : OFF;
 }
 
-node_id life_4x4(node_table *table, node_id id)
+/* One generation of the centre 2x2 of a level 2 node, using the rule's
+    table for an even or odd generation */
+node_id life_4x4(node_table *table, node_id id, bool odd)
 {
     node *n = lookup(table, id);
-    node_id na, nb, nc, nd;
     node *a = lookup(table, n->a);
     node *b = lookup(table, n->b);
     node *c = lookup(table, n->c);
     node *d = lookup(table, n->d);
     uint64_t on = table->on;
-    uint64_t off = table->off;
-    na = base_life(a->a, a->b, b->a, a->c, a->d, b->c, c->a, c->b, d->a, on, off);
-    nb = base_life(a->b, b->a, b->b, a->d, b->c, b->d, c->b, d->a, d->b, on, off);
-    nc = base_life(a->c, a->d, b->c, c->a, c->b, d->a, c->c, c->d, d->c, on, off);
-    nd = base_life(a->d, b->c, b->d, c->b, d->a, d->b, c->d, d->c, d->d, on, off);
+    // the 4x4 cells as a bitmask, row-major from the top left
+    node_id cells[16] = {a->a, a->b, b->a, b->b, a->c, a->d, b->c, b->d,
+                         c->a, c->b, d->a, d->b, c->c, c->d, d->c, d->d};
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)(cells[i] == on) << i;
+    // the 3x3 neighbourhood of each inner cell, in rule index order
+#define NEIGHBOURHOOD(x, y) (((bits >> ((y) * 4 + (x))) & 7) | (((bits >> ((y) * 4 + (x) + 4)) & 7) << 3) | (((bits >> ((y) * 4 + (x) + 8)) & 7) << 6))
+    const uint8_t *next = table->rule.phase[odd];
+    node_id na = next[NEIGHBOURHOOD(0, 0)] ? on : table->off;
+    node_id nb = next[NEIGHBOURHOOD(1, 0)] ? on : table->off;
+    node_id nc = next[NEIGHBOURHOOD(0, 1)] ? on : table->off;
+    node_id nd = next[NEIGHBOURHOOD(1, 1)] ? on : table->off;
+#undef NEIGHBOURHOOD
     return join(table, na, nb, nc, nd);
 }
 
@@ -339,7 +1370,9 @@ void set_flag(node_table *table, node_id id)
 {
     if (LEVEL(id) <= 2)
         return;
-    node *n = lookup(table, id);
+    node *n = lookup_own(table, id);
+    if (n->id != id) // already marked (or held by the parent of a fork, which keeps it)
+        return;
 
     // set the high bit of pop
     n->id = MARK(n->id);
@@ -350,13 +1383,165 @@ void set_flag(node_table *table, node_id id)
     set_flag(table, n->d);
 }
 
+/* Arena relayout: where each old position goes */
+enum
+{
+    UNPLACED,
+    PLACED,  // given its new position
+    EXPANDED // ... and its children placed too
+};
+
+typedef struct placement
+{
+    uint64_t *order; // old positions, in their new order
+    uint8_t *state;  // by old position
+    uint64_t n;
+} placement;
+
+/* Put id next in the new order, unless it is already placed or not in this
+    table (but a fork's parent); returns its old position, or UINT64_MAX */
+static uint64_t place(node_table *table, placement *pl, node_id id)
+{
+    dir_entry *e = dir_probe(table, id);
+    if (e->id != id)
+        return UINT64_MAX;
+    if (pl->state[e->pos] == UNPLACED)
+    {
+        pl->state[e->pos] = PLACED;
+        pl->order[pl->n++] = e->pos;
+    }
+    return e->pos;
+}
+
+/* Place id and everything under it, in the given RELAYOUT_* order */
+static void place_subtree(node_table *table, placement *pl, node_id id, int order)
+{
+    uint64_t pos = place(table, pl, id);
+    if (pos == UINT64_MAX || pl->state[pos] == EXPANDED || LEVEL(id) == 0)
+        return;
+    pl->state[pos] = EXPANDED;
+    node *n = &table->index[pos];
+    node_id children[4] = {n->a, n->b, n->c, n->d};
+    if (order == RELAYOUT_MORTON)
+        for (int q = 0; q < 4; q++)
+            place(table, pl, children[q]);
+    for (int q = 0; q < 4; q++)
+        place_subtree(table, pl, children[q], order);
+}
+
+/* Rewrite an arena table's nodes: those under the roots first, in the
+    given order, then the rest as they were. If drop is set, nodes above
+    level 2 not marked by set_flag() are left out (a vacuum). */
+static void rewrite_arena(node_table *table, const node_id *roots, uint64_t n_roots, int order, bool drop)
+{
+    placement pl = {.order = malloc(table->count * sizeof(uint64_t)), .state = calloc(table->count, 1), .n = 0};
+    for (uint64_t r = 0; r < n_roots; r++)
+        place_subtree(table, &pl, roots[r], order);
+    for (uint64_t i = 0; i < table->count; i++)
+        if (pl.state[i] == UNPLACED &&
+            (!drop || IS_MARKED(table->index[i].id) || LEVEL(table->index[i].id) <= 2))
+            pl.order[pl.n++] = i;
+
+    node *old_index = table->index;
+    table_mem old_mem = table->mem;
+    table->index = (node *)table_mem_alloc(&table->mem, table->size * sizeof(node), table->alloc_flags);
+    for (uint64_t k = 0; k < pl.n; k++)
+    {
+        node *old = &old_index[pl.order[k]], *n = &table->index[k];
+        n->id = UNMARK(old->id);
+        n->a = old->a;
+        n->b = old->b;
+        n->c = old->c;
+        n->d = old->d;
+        n->pop = old->pop;
+    }
+    table->count = pl.n;
+    table_mem_free(&old_mem);
+    free(pl.order);
+    free(pl.state);
+    rebuild_dir(table);
+    for (uint64_t k = 0; k < pl.n; k++)
+    {
+        node *n = &table->index[k];
+        node *children[4] = {lookup(table, n->a), lookup(table, n->b), lookup(table, n->c), lookup(table, n->d)};
+        link_children(table, n, children);
+    }
+    if (drop)
+        clean_cache(table);
+}
+
+/* Rewrite an arena table's nodes in a RELAYOUT_* order, those reachable
+    from the roots first, so that descents from them read nearby memory.
+    Node IDs, and the successor cache, are unchanged, and nothing is
+    freed. Later vacuums keep the same order. Does nothing unless the
+    table was made with ALLOC_ARENA.
+*/
+void relayout(node_table *table, const node_id *roots, uint64_t n_roots, int order)
+{
+    if (!table->dir)
+        return;
+    TRACE_BEGIN(t0, true);
+    table->layout = order;
+    rewrite_arena(table, roots, n_roots, order, false);
+    TRACE_END(t0, "relayout", 0, "nodes", table->count);
+}
+
 /* Remove all nodes not a child of top */
 void vacuum(node_table *table, node_id top)
 {
-    // walk the tree, marking all reachable nodes
-    set_flag(table, top);
+    vacuum_roots(table, &top, 1);
+}
+
+/* Remove all nodes not a child of one of the n roots
+    (for a shared table, once every process has asked; see shared.h) */
+void vacuum_roots(node_table *table, const node_id *roots, uint64_t n_roots)
+{
+#if HL_STATS
+    uint64_t t0 = now_ns();
+    uint64_t before = table->count;
+#endif
+    TRACE_BEGIN(t1, true);
+    if (table->shared)
+        shared_vacuum(table, roots, n_roots);
+    else
+    {
+        // walk the trees, marking all reachable nodes
+        for (uint64_t r = 0; r < n_roots; r++)
+            set_flag(table, roots[r]);
+        if (table->dir)
+            rewrite_arena(table, roots, n_roots, table->layout, true);
+        else
+            vacuum_marked(table);
+    }
+    TRACE_END(t1, "vacuum", 0, "survivors", table->count);
+#if HL_STATS
+    table->stats.vacuums++;
+    table->stats.vacuum_ns += now_ns() - t0;
+    table->stats.vacuum_survivors = table->count;
+    table->stats.vacuum_freed += before - table->count;
+#endif
+}
+
+/* Remove every node above level 2 not marked by set_flag(), and every
+    successor cache entry that refers to one. A shared table is compacted
+    in place (from a private copy), as it cannot be remapped. */
+void vacuum_marked(node_table *table)
+{
+    if (table->dir)
+    {
+        rewrite_arena(table, NULL, 0, table->layout, true);
+        return;
+    }
     node *old_index = table->index;
-    table->index = (node *)calloc(table->size, sizeof(node));
+    table_mem old_mem = table->mem;
+    if (table->shared)
+    {
+        old_index = (node *)table_mem_alloc(&old_mem, table->size * sizeof(node), table->alloc_flags);
+        memcpy(old_index, table->index, table->size * sizeof(node));
+        memset(table->index, 0, table->size * sizeof(node));
+    }
+    else
+        table->index = (node *)table_mem_alloc(&table->mem, table->size * sizeof(node), table->alloc_flags);
     table->count = 0;
     for (uint64_t i = 0; i < table->size; i++)
     {
@@ -365,23 +1550,32 @@ void vacuum(node_table *table, node_id top)
         n->id = UNMARK(n->id);
         if (n->id != UNUSED && (LEVEL(n->id) <= 2 || marked))
         {            
-            node *slot = lookup(table, n->id);            
+            node *slot = lookup_own(table, n->id);
             assert(slot->id == UNUSED); // should not already exist
             *slot = *n;            
             table->count++;
         }        
     }
-    /* now clear up the successor cache */
+    table_mem_free(&old_mem);
+    clean_cache(table);
+    if (table->shared)
+        table->shared->count = table->count;
+}
+
+/* Clear every successor cache entry to or from a node that is gone */
+static void clean_cache(node_table *table)
+{
     for (uint64_t i = 0; i < table->size; i++)
     {
-        node *n = &table->index[i];        
+        node *n = &cache_slots(table)[i];        
         /* 
         check; are we mapping to a successor? 
         make sure that successor actually still exists! 
         */
         if (n->to != UNUSED)
         {
-            if (lookup(table, n->to)->id != n->to || lookup(table, n->from)->id != n->from)
+            node_id to = UNMARK(n->to), from = UNMARK(n->from); // without the entry's age
+            if (lookup(table, to)->id != to || lookup(table, from)->id != from)
             {
                 // invalid node, delete it
                 n->from = UNUSED;
@@ -393,24 +1587,58 @@ void vacuum(node_table *table, node_id top)
 }
 
 node_table *create_table(uint64_t initial_size)
+{
+    return create_table_alloc(initial_size, ALLOC_DEFAULT);
+}
+
+/* Create a table whose index is allocated with the given ALLOC_* policy */
+node_table *create_table_alloc(uint64_t initial_size, uint32_t alloc_flags)
 {
     node_table *table = (node_table *)malloc(sizeof(node_table));
     table->size = initial_size < 16 ? 16 : initial_size;
-    table->index = (node *)calloc(table->size, sizeof(node));
+    table->alloc_flags = alloc_flags;
+    table->symmetry_level = 0;
+    parse_rule("B3/S23", &table->rule);
+    table->parent = NULL;
+    table->parent_successors = false;
+    table->shared = NULL;
+    table->dir = NULL;
+    table->cache = NULL;
+    table->layout = RELAYOUT_DFS;
+    memset(&table->dir_mem, 0, sizeof(table->dir_mem));
+    memset(&table->cache_mem, 0, sizeof(table->cache_mem));
+    reset_stats(table);
+    table->index = (node *)table_mem_alloc(&table->mem, table->size * sizeof(node), alloc_flags);
     table->off = (0ULL << 63) | (1ULL << 62) | (0ULL << 46) | HASH_MASK(mix64(0));
     table->on = (0ULL << 63) | (0ULL << 62) | (0ULL << 46) | HASH_MASK(mix64(1));
 
     uint64_t mask = table->size - 1;
     /* cell level nodes */
-    table->index[(table->off) & mask] = (node){.a = 0, .b = 0, .c = 0, .d = 0, .pop = 0, .id = table->off}; // off node
-    table->index[(table->on) & mask] = (node){.a = 0, .b = 0, .c = 0, .d = 0, .pop = 1, .id = table->on};   // on node
+    node_id off_slot = table->off & mask, on_slot = table->on & mask;
+    if (alloc_flags & ALLOC_ARENA)
+        off_slot = 0, on_slot = 1;
+    table->index[off_slot] = (node){.a = 0, .b = 0, .c = 0, .d = 0, .pop = 0, .id = table->off}; // off node
+    table->index[on_slot] = (node){.a = 0, .b = 0, .c = 0, .d = 0, .pop = 1, .id = table->on};   // on node
     table->count = 2;
+    if (alloc_flags & ALLOC_ARENA)
+    {
+        table->cache = (node *)table_mem_alloc(&table->cache_mem, table->size * sizeof(node), alloc_flags);
+        rebuild_dir(table);
+    }
     return table;
 }
 
+/* Free a table (or detach from a shared one) */
 void free_table(node_table *table)
 {
-    free(table->index);
+    if (table->shared)
+    {
+        close_shared_table(table);
+        return;
+    }
+    table_mem_free(&table->mem);
+    table_mem_free(&table->dir_mem);
+    table_mem_free(&table->cache_mem);
     free(table);
 }   
 
@@ -451,7 +1679,7 @@ node_id crop(node_table *table, node_id id)
 /* Repeatedly centre the node, until the node is fully padded */
 node_id pad(node_table *table, node_id id)
 {
-    while (LEVEL(id) < 3 || is_padded(table, id))
+    while (id != UNUSED && (LEVEL(id) < 3 || !is_padded(table, id)))
         id = centre(table, id);
     return id;
 }
@@ -459,7 +1687,8 @@ node_id pad(node_table *table, node_id id)
 /* Set the cell at the given position, returning the new node */
 node_id set_cell(node_table *table, node_id id, uint64_t x, uint64_t y, bool state)
 {
-
+    if (id == UNUSED)
+        return UNUSED;
     if (LEVEL(id) == 0)
     {
         if (state)
@@ -471,10 +1700,11 @@ node_id set_cell(node_table *table, node_id id, uint64_t x, uint64_t y, bool sta
     while (x >= (1ULL << LEVEL(id)) || y >= (1ULL << LEVEL(id)))
     {
         node_id z = get_zero(table, LEVEL(id));
-        id = join(table, id, z, z, z);
+        if ((id = join(table, id, z, z, z)) == UNUSED)
+            return UNUSED;
     }
     node *n = lookup(table, id);
-    uint64_t offset = 1 << (LEVEL(id) - 1);
+    uint64_t offset = 1ULL << (LEVEL(id) - 1);
     node_id a = n->a;
     node_id b = n->b;
     node_id c = n->c;
@@ -490,25 +1720,152 @@ node_id set_cell(node_table *table, node_id id, uint64_t x, uint64_t y, bool sta
     return join(table, a, b, c, d);
 }
 
+/* Interleave the bits of x (even) and y (odd), so quadrant order is sort order */
+static uint64_t morton(uint64_t x, uint64_t y)
+{
+    uint64_t key = 0;
+    for (int bit = 0; bit < 32; bit++)
+        key |= ((x >> bit & 1) << (2 * bit)) | ((y >> bit & 1) << (2 * bit + 1));
+    return key;
+}
+
+typedef struct edit_key
+{
+    uint64_t key, index; // Morton order, then position in the batch
+} edit_key;
+
+static int compare_edit_keys(const void *p, const void *q)
+{
+    const edit_key *a = p, *b = q;
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/* Rebuild id (of the given level) with the sorted edits keys[lo, hi) applied */
+static node_id rebuild(node_table *table, node_id id, uint64_t level, const edit_key *keys, const cell_edit *edits, uint64_t lo, uint64_t hi)
+{
+    if (lo == hi)
+        return id;
+    if (level == 0) // the last edit of a cell wins
+        return edits[keys[hi - 1].index].state ? table->on : table->off;
+    node n = *lookup(table, id);
+    node_id q[4] = {n.a, n.b, n.c, n.d};
+    uint64_t shift = 2 * (level - 1);
+    // the edits of each quadrant are contiguous, in quadrant order
+    for (uint64_t k = 0; k < 4; k++)
+    {
+        uint64_t end = lo;
+        while (end < hi && (shift >= 64 ? 0 : (keys[end].key >> shift) & 3) == k)
+            end++;
+        q[k] = rebuild(table, q[k], level - 1, keys, edits, lo, end);
+        lo = end;
+    }
+    return join(table, q[0], q[1], q[2], q[3]);
+}
+
+/* Apply a batch of cell edits in one pass, returning the new node. The
+    edits are sorted into Morton order, so each node on the way to an
+    edited cell is rebuilt (joined) once, however many edits are under it,
+    instead of once per edit as with set_cell(). If a cell is edited more
+    than once, the last edit wins. Edits with x or y of 2^32 or more, which
+    have no 64-bit Morton key, are made with set_cell() afterwards, as are
+    all of them if there is no memory to sort them.
+*/
+node_id apply_edits(node_table *table, node_id id, const cell_edit *edits, uint64_t n)
+{
+    if (n == 0)
+        return id;
+    TRACE_BEGIN(t0, true);
+    edit_key *keys = malloc(n * sizeof(edit_key));
+    uint64_t max_x = 0, max_y = 0, sorted = 0;
+    for (uint64_t i = 0; keys && i < n; i++)
+    {
+        if (edits[i].x >> 32 || edits[i].y >> 32)
+            continue;
+        keys[sorted].key = morton(edits[i].x, edits[i].y);
+        keys[sorted++].index = i;
+        max_x = edits[i].x > max_x ? edits[i].x : max_x;
+        max_y = edits[i].y > max_y ? edits[i].y : max_y;
+    }
+    if (sorted)
+    {
+        qsort(keys, sorted, sizeof(edit_key), compare_edit_keys);
+        // expand the node until every edit is inside it
+        while (id != UNUSED && (max_x >= (1ULL << LEVEL(id)) || max_y >= (1ULL << LEVEL(id))))
+        {
+            node_id z = get_zero(table, LEVEL(id));
+            id = join(table, id, z, z, z);
+        }
+        if (id != UNUSED)
+            id = rebuild(table, id, LEVEL(id), keys, edits, 0, sorted);
+    }
+    bool all = !keys;
+    free(keys);
+    // the rest never touch a cell of the batch above, so their order with it does not matter
+    for (uint64_t i = 0; sorted < n && i < n; i++)
+        if (all || edits[i].x >> 32 || edits[i].y >> 32)
+            id = set_cell(table, id, edits[i].x, edits[i].y, edits[i].state);
+    TRACE_END(t0, "apply_edits", LEVEL(id), "edits", n);
+    return id;
+}
+
+/* Turn on n cells, given as x, y pairs, in one pass (see apply_edits()) */
+node_id set_cells(node_table *table, node_id id, const uint64_t *xy, uint64_t n)
+{
+    cell_edit *edits = malloc((n ? n : 1) * sizeof(cell_edit));
+    if (!edits) // one at a time, then
+    {
+        for (uint64_t i = 0; i < n; i++)
+            id = set_cell(table, id, xy[2 * i], xy[2 * i + 1], true);
+        return id;
+    }
+    for (uint64_t i = 0; i < n; i++)
+        edits[i] = (cell_edit){xy[2 * i], xy[2 * i + 1], true};
+    id = apply_edits(table, id, edits, n);
+    free(edits);
+    return id;
+}
+
+/* Clear every cell in the w x h rectangle at (x, y), rebuilding only the
+    nodes that straddle its edge; nodes wholly inside become empty */
+node_id clear_rect(node_table *table, node_id id, uint64_t x, uint64_t y, uint64_t w, uint64_t h)
+{
+    uint64_t size = 1ULL << LEVEL(id);
+    node *n = lookup(table, id);
+    if (n->pop == 0 || w == 0 || h == 0 || x >= size || y >= size)
+        return id;
+    if (x == 0 && y == 0 && w >= size && h >= size)
+        return get_zero(table, LEVEL(id));
+    uint64_t x1 = x + w < x ? UINT64_MAX : x + w, y1 = y + h < y ? UINT64_MAX : y + h; // exclusive
+    node_id q[4] = {n->a, n->b, n->c, n->d};
+    uint64_t half = size / 2;
+    for (int k = 0; k < 4; k++)
+    {
+        // the part of the rectangle over quadrant k, in its own frame
+        uint64_t ox = (k & 1) * half, oy = (k >> 1) * half;
+        uint64_t qx = x > ox ? x : ox, qy = y > oy ? y : oy;
+        if (qx < x1 && qy < y1)
+            q[k] = clear_rect(table, q[k], qx - ox, qy - oy, x1 - qx, y1 - qy);
+    }
+    return join(table, q[0], q[1], q[2], q[3]);
+}
+
 /* Get the grey level at the given position and level */
 float get_cell(node_table *table, node_id id, uint64_t x, uint64_t y, uint64_t level)
 {
     node *n = lookup(table, id);
-    if (LEVEL(id) == 0 || LEVEL(id) == level)
-        return n->pop / (float)(1 << (2 * LEVEL(id)));
-    uint64_t size = 1 << LEVEL(id);
+    uint64_t size = 1ULL << LEVEL(id);
     // bounds test
-    if (x >= size || y >= size)
+    if (LEVEL(id) != 0 && LEVEL(id) != level && (x >= size || y >= size))
         return 0.0f;
-    // recursive descent
-
-    uint64_t offset = 1 << (LEVEL(id) - 1);
-    if (x < offset && y < offset)
-        return get_cell(table, n->a, x, y, level);
-    else if (x >= offset && y < offset)
-        return get_cell(table, n->b, x - offset, y, level);
-    else if (x < offset && y >= offset)
-        return get_cell(table, n->c, x, y - offset, level);
-    else
-        return get_cell(table, n->d, x - offset, y - offset, level);
+    // descend to the quadrant holding (x, y), level by level
+    while (LEVEL(n->id) != 0 && LEVEL(n->id) != level)
+    {
+        uint64_t offset = 1ULL << (LEVEL(n->id) - 1);
+        n = child(table, n, (x >= offset) + 2 * (y >= offset));
+        x &= offset - 1;
+        y &= offset - 1;
+    }
+    return n->pop / (float)(1ULL << (2 * LEVEL(n->id)));
 }
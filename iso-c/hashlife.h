@@ -7,6 +7,9 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include "table_alloc.h"
+#include "stats.h"
+#include "rule.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define INIT_TABLE_SIZE 4096
@@ -16,6 +19,13 @@
 typedef uint64_t node_id;
 static const node_id UNUSED = 0;
 
+#define CACHE_TAG (1ULL << 63) // successor cache j tag for non-successor entries
+#define CACHE_EXTRACT (CACHE_TAG | (0ULL << 60))   // extract(): | level << 54 | x << 27 | y
+#define CACHE_TRANSFORM (CACHE_TAG | (1ULL << 60)) // transform(): | t
+#define CACHE_PHASE (1ULL << 62) // successor j flag: starts at an odd generation (B0 rules)
+#define CACHE_WAYS 2             // slots per successor cache bucket (cache_next() picks between two)
+#define CACHE_STALE 3            // age at which an unused cache entry is worth nothing
+
 /* Define macros for setting, clearing, and testing the MSB of pop */
 #define MARK(x) ((x) | (1ULL << 63))
 #define UNMARK(x) ((x) & ~(1ULL << 63))
@@ -48,12 +58,57 @@ This is a convenience cache which just accelerates calls to successor().
 Generally, this cache is much sparser than the node table,
 and so we just layer "underneath" the main table.
 
-This does not even probe; it either matches on the first hash, or we
-recompute the successor.
+It does not probe: (from,j) hashes to a bucket of CACHE_WAYS adjacent
+slots, and either matches in one of those or we recompute the successor.
+When a new entry finds its bucket full, the entry worth less goes. An
+entry is worth roughly the levels of work it saves (the level of from,
+plus j for a successor), halved for each time it has been kept over its
+neighbour without being hit since; after CACHE_STALE such contests it is
+worth nothing. So a top-level successor survives a burst of low-level
+churn through its bucket, but not for ever once it stops being used.
+The age lives in the mark bits of from and to, which a node ID in the
+cache never needs.
 
 Any element of the successor cache can freely be deleted or overwritten
 without affecting correctness; it will automatically be recomputed as needed.
 
+Under alternating (B0) rules a successor also depends on whether it
+starts at an odd generation, so those have CACHE_PHASE set in j.
+
+Entries whose j has CACHE_TAG set are not successors, but other memoised
+node -> node maps (extract(), transform()), keyed by the rest of j.
+
+-- Symmetry --
+With set_symmetry(), successors of nodes at or above a level are shared
+between the eight rotations and reflections of each node: on a miss, the
+orientations that already exist are probed (without creating any), and a
+successor found for one is transformed back, so each equivalence class
+does its successor work only once.
+
+-- Forks --
+fork_table() makes a table layered over a frozen parent. Interned nodes
+never change, so lookups (and successor cache probes) that miss in the
+fork's own index fall through to the parent's; new nodes and cache
+entries go only in the fork. Vacuuming a fork keeps the parent intact.
+
+-- Arena layout --
+In a table created with ALLOC_ARENA, a node is not stored in the slot
+its ID hashes to. Nodes fill the index densely from slot 0, and a
+separate directory of (id, position) pairs, probed by ID, finds them.
+Nodes can then be put in any order: relayout() (and every vacuum)
+rewrites them depth-first from the given roots, so a node's children sit
+next to it, and a descent reads nearby memory instead of a random slot
+per level.
+
+An arena node's from/to/j hold the positions of its four children
+(j == ARENA_LINKED), so get_cell(), cell_iter and the leaves of the
+successor go from a node to its children without probing the directory
+at all. Positions are stored in 32 bits: a node with a child past slot
+2^32 stays unlinked, and its children are looked up as usual. The
+successor cache moves to a separate array of the same size, and keeps
+its entries across a relayout. An arena table so takes about twice the
+memory of a plain one.
+
 */
 
 typedef struct node
@@ -68,14 +123,121 @@ typedef struct node
     uint64_t j;       
 } node;
 
+#define ARENA_LINKED 1 // j of an arena node whose from/to hold its children's positions (32 bits each)
+
+/* Where an arena table keeps a node */
+typedef struct dir_entry
+{
+    node_id id;
+    uint64_t pos; // index of the node
+} dir_entry;
+
+/* Node orders for relayout() */
+enum
+{
+    RELAYOUT_DFS,   // each node, then its subtrees in turn (a, b, c, d: Morton order of first appearance)
+    RELAYOUT_MORTON // each node's four children together in Morton order, then their subtrees
+};
+
 typedef struct node_table
 {
     node_id on, off;
     node *index;    
     uint64_t size;  // number of slots (always a power of 2)
     uint64_t count; // number of allocated slots
+    uint32_t alloc_flags; // ALLOC_* policy used for the index
+    uint64_t symmetry_level; // canonicalise successors from this level up (0 = off)
+    life_rule rule;          // the rule every successor in this table is computed under
+    struct node_table *parent; // a fork's parent, read through on every miss (NULL if not a fork)
+    bool parent_successors;    // the parents' successors are valid here (same rule)
+    struct shared_header *shared; // the shared memory header, if the index is shared (see shared.h)
+    dir_entry *dir;       // ALLOC_ARENA only: where each node is, probed by ID (size slots)
+    node *cache;          // ALLOC_ARENA only: the successor cache (size slots); otherwise it is in index
+    int layout;           // ALLOC_ARENA only: the RELAYOUT_* order vacuum keeps
+    table_mem mem;        // how the current index was obtained
+    table_mem dir_mem;
+    table_mem cache_mem;
+    table_stats stats;
 } node_table;
 
+/* Resumable advance
+
+advance_begin() / ffwd_begin() set up the state, and each advance_poll()
+does bounded work until a deadline, so long runs can report progress and
+be cancelled. Large steps are split into leaps of at most 2^max_j
+generations. The root is only ever replaced by a complete step, so
+advance_result() is always a consistent pattern, generations on from the
+start. Pin state->root if the table is vacuumed between polls.
+*/
+#define ADVANCE_MAX_J 16
+
+enum
+{
+    ADVANCE_DONE,
+    ADVANCE_RUNNING,
+    ADVANCE_CANCELLED,
+    ADVANCE_FULL // a shared table needs vacuuming (see shared.h)
+};
+
+typedef struct advance_state
+{
+    node_id root;           // the pattern after `generations` steps (padded)
+    uint64_t remaining;     // generations (or ffwd leaps) still to do
+    uint64_t generations;   // generations completed so far
+    uint64_t start_count;   // table->count when started
+    uint64_t nodes_created; // net nodes added to the table so far
+    uint64_t max_j;         // largest leap per step is 2^max_j generations
+    bool leap;              // ffwd: each step is one natural successor
+    volatile bool cancel;   // set (e.g. from a signal handler) to stop at the next step
+} advance_state;
+
+/* Fixed-step stepping
+
+A stepper advances by the same number of generations every step, keeping
+the root at a fixed, padded size (grown only when the pattern nears the
+border), so each step reuses the successor cache entries of the last
+instead of re-padding as advance() does. Pin stepper.root across vacuum.
+*/
+typedef struct stepper
+{
+    node_id root;        // the padded universe at `generation`
+    uint64_t step;       // generations per step
+    uint64_t generation; // generations done so far
+    uint64_t max_j;      // highest set bit of step
+} stepper;
+
+/* Live cell iteration
+
+Walks a node once, depth first with an explicit stack, skipping empty
+(pop == 0) subtrees and any outside the clip rectangle, so the cost is in
+proportion to the live cells found. cell_iter_next() fills a caller's
+buffer with (x, y) pairs and can be called again for the next chunk. The
+table must not be vacuumed while an iterator is in use.
+*/
+#define CELL_ITER_STACK (3 * 64 + 4) // three siblings pending per level, and up to four cells
+
+typedef struct cell_iter
+{
+    node_table *table;
+    int64_t x0, y0, x1, y1; // clip rectangle, half-open
+    int depth;              // entries on the stack
+    struct
+    {
+        node_id id;
+        int64_t x, y; // top left
+        uint64_t pos; // the slot it was seen in, if in table's own index (checked before use)
+    } stack[CELL_ITER_STACK];
+} cell_iter;
+
+/* One sample of a population series. Under a B0 rule, an odd generation's
+   pop and box are of the stored cells, which are the inverse of the pattern */
+typedef struct pop_sample
+{
+    uint64_t generation;
+    uint64_t pop;
+    int64_t x0, y0, x1, y1; // inclusive bounding box, if asked for (all 0 if empty)
+} pop_sample;
+
 /* Hash functions */
 uint64_t mix64(uint64_t x);
 uint64_t hash_quad(uint64_t a, uint64_t b, uint64_t c, uint64_t d);
@@ -83,19 +245,29 @@ uint64_t merge(node_id a, node_id b, node_id c, node_id d);
 
 /* Table operations */
 void vacuum(node_table *table, node_id top);
+void vacuum_roots(node_table *table, const node_id *roots, uint64_t n_roots);
+void set_flag(node_table *table, node_id id);
+void vacuum_marked(node_table *table);
+void relayout(node_table *table, const node_id *roots, uint64_t n_roots, int order);
+void resize_table(node_table *table);
 node_id get_zero(node_table *table, uint64_t k);
 node *lookup(node_table *table, node_id hash);
 node_id join(node_table *table, node_id a_hash, node_id b_hash, node_id c_hash, node_id d_hash);
 
+/* Rules */
+int set_rule(node_table *table, const char *rule);
+
 /* Initalisation, copy and free */
 node_table *create_table(uint64_t initial_size);
+node_table *create_table_alloc(uint64_t initial_size, uint32_t alloc_flags);
 node_table *copy_table(node_table *old_table);
+node_table *fork_table(node_table *parent, uint64_t initial_size);
 void free_table(node_table *table);
 
 
 
 node_id base_life(node_id a, node_id b, node_id c, node_id d, node_id e, node_id f, node_id g, node_id h, node_id i, node_id on, node_id off);
-node_id life_4x4(node_table *table, node_id m_h);
+node_id life_4x4(node_table *table, node_id m_h, bool odd);
 
 /* Node operations */
 node_id centre(node_table *table, node_id m_h);
@@ -105,10 +277,57 @@ bool is_padded(node_table *table, node_id id);
 node_id crop(node_table *table, node_id id);
 node_id pad(node_table *table, node_id id);
 node_id successor(node_table *table, node_id id, uint64_t j);
+node_id successor_exact(node_table *table, node_id id, uint64_t j);
+node_id lookup_next(node_table *table, node_id from, uint64_t j);
+void cache_next(node_table *table, node_id from, node_id to, uint64_t j);
 node_id ffwd(node_table *table, node_id id, uint64_t steps, uint64_t *generations);
 
+/* Resumable advance */
+void advance_begin(node_table *table, advance_state *state, node_id id, uint64_t steps);
+void ffwd_begin(node_table *table, advance_state *state, node_id id, uint64_t leaps);
+int advance_poll(node_table *table, advance_state *state, uint64_t deadline_ns);
+node_id advance_result(node_table *table, advance_state *state);
+
+/* Fixed-step stepping */
+void stepper_init(node_table *table, stepper *st, node_id id, uint64_t step);
+node_id stepper_step(node_table *table, stepper *st);
+node_id stepper_pattern(node_table *table, stepper *st);
+
+/* Population series */
+bool bounding_box(node_table *table, node_id id, int64_t *x0, int64_t *y0, int64_t *x1, int64_t *y1);
+uint64_t pop_series(node_table *table, node_id id, uint64_t t0, uint64_t t1, uint64_t stride, pop_sample *out, bool bbox);
+
+node_id extract(node_table *table, node_id id, int64_t x, int64_t y, uint64_t level);
+#define REGION_MAX_STEPS (1ULL << 58) // advance_region()'s light cone must fit in 64-bit coordinates
+node_id advance_region(node_table *table, node_id id, uint64_t steps, int64_t x, int64_t y, uint64_t w, uint64_t h);
+
+/* Live cell iteration */
+void cell_iter_init(node_table *table, cell_iter *it, node_id id, int64_t x, int64_t y);
+void cell_iter_clip(cell_iter *it, int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+uint64_t cell_iter_next(cell_iter *it, int64_t *xy, uint64_t max);
+
+/* Structural diff: called for each changed tile, with the tile before and after */
+typedef void (*diff_callback)(void *ctx, int64_t x, int64_t y, uint64_t level, node_id before, node_id after);
+uint64_t diff(node_table *table, node_id a, int64_t ax, int64_t ay, node_id b, int64_t bx, int64_t by,
+              uint64_t tile_level, diff_callback emit, void *ctx);
+
+/* Symmetry */
+node_id transform(node_table *table, node_id id, int t);
+int inverse_transform(int t);
+node_id find_transform(node_table *table, node_id id, int t);
+void set_symmetry(node_table *table, uint64_t min_level);
+
 /* Cell access */
+typedef struct cell_edit
+{
+    uint64_t x, y;
+    bool state;
+} cell_edit;
+
 node_id set_cell(node_table *table, node_id id, uint64_t x, uint64_t y, bool state);
+node_id apply_edits(node_table *table, node_id id, const cell_edit *edits, uint64_t n);
+node_id set_cells(node_table *table, node_id id, const uint64_t *xy, uint64_t n);
+node_id clear_rect(node_table *table, node_id id, uint64_t x, uint64_t y, uint64_t w, uint64_t h);
 float get_cell(node_table *table, node_id id, uint64_t x, uint64_t y, uint64_t level);
 
 #endif // HASHLIFE_H
\ No newline at end of file
@@ -1,25 +1,153 @@
 #include "hashlife.h"
 #include "cell_io.h"
+#include "trace.h"
+#include "serve.h"
+#include "period.h"
+#include "soup.h"
 
 
 /* Simple main. 
-   Expects arguments of the form <file.rle> <generations>
-   Reads RLE from stdin, writes RLE to stdout.
+   Expects arguments of the form [options] <pattern> <generations>
+   Reads the pattern (RLE, Life 1.05/1.06 or plaintext), writes RLE to stdout.
+   Or, with --serve, keeps one table warm and reads commands (see serve.h).
+
+   Options:
+     --stats             print engine statistics to stderr after the run
+     --trace <file>      write a Chrome/Perfetto trace of the run to file
+     --trace-level <n>   only trace successor calls at level n and above (default 8)
+     --rule <rule>       run under a rule such as B36/S23 or B2a/S12 (default: the file's rule)
+     --symmetry <level>  share successors between rotated / reflected nodes from level up
+     --series <stride>   instead of RLE, print "generation population x0 y0 x1 y1"
+                         every stride generations, up to <generations>
+     --period            instead of RLE, look for a period within <generations>
+     --soups <n>         search n random soups, and print a census of their ash
+     --seed <s>          with --soups, the search seed (default 0)
+     --threads <t>       with --soups, the number of worker threads (default 1)
+     --serve             serve commands from stdin
+     --socket <path>     with --serve, listen on a UNIX socket instead
+     --vacuum-at <n>     with --serve, vacuum whenever the table holds n nodes
 */
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    bool stats = false, serve = false, period = false;
+    char *socket_path = NULL;
+    uint64_t vacuum_at = 0;
+    char *trace_file = NULL, *rule = NULL;
+    uint64_t trace_level = 8;
+    uint64_t series_stride = 0, symmetry = 0;
+    soup_params soups;
+    soup_params_default(&soups);
+    soups.n_soups = 0;
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++)
+    {
+        if (!strcmp(argv[arg], "--stats"))
+            stats = true;
+        else if (!strcmp(argv[arg], "--trace") && arg + 1 < argc)
+            trace_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--trace-level") && arg + 1 < argc)
+            trace_level = strtoull(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--rule") && arg + 1 < argc)
+            rule = argv[++arg];
+        else if (!strcmp(argv[arg], "--symmetry") && arg + 1 < argc)
+            symmetry = strtoull(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--series") && arg + 1 < argc)
+            series_stride = strtoull(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--period"))
+            period = true;
+        else if (!strcmp(argv[arg], "--soups") && arg + 1 < argc)
+            soups.n_soups = strtoull(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--seed") && arg + 1 < argc)
+            soups.seed = strtoull(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--threads") && arg + 1 < argc)
+            soups.threads = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "--serve"))
+            serve = true;
+        else if (!strcmp(argv[arg], "--socket") && arg + 1 < argc)
+            socket_path = argv[++arg];
+        else if (!strcmp(argv[arg], "--vacuum-at") && arg + 1 < argc)
+            vacuum_at = strtoull(argv[++arg], NULL, 10);
+        else
+            break;
+    }
+    if (serve && arg != argc)
+    {
+        printf("--serve reads its patterns from commands: no <pattern> or <generations>\n");
+        return 1;
+    }
+    if (serve)
+    {
+        static server srv;
+        if (trace_file)
+            trace_start(trace_level);
+        serve_init(&srv, create_table(INIT_TABLE_SIZE));
+        srv.auto_vacuum = vacuum_at;
+        int result = socket_path ? serve_socket(&srv, socket_path) : (serve_stream(&srv, stdin, stdout), 0);
+        if (trace_file)
+            result |= trace_write_json(trace_file);
+        return result;
+    }
+    if (soups.n_soups && arg == argc)
+    {
+        census result;
+        uint64_t t0 = now_ns();
+        soup_search(&soups, &result);
+        census_print(&result, stdout);
+        fprintf(stderr, "%.1f soups/s\n", soups.n_soups / ((now_ns() - t0) / 1e9));
+        census_free(&result);
+        return 0;
+    }
+    if (argc - arg != 2)
     {
-        printf("Usage: %s <file.rle> <generations>\n", argv[0]);
+        printf("Usage: %s [--stats] [--trace <file.json>] [--trace-level <n>] [--rule <rule>] [--symmetry <level>] [--series <stride>] [--period] <pattern> <generations>\n", argv[0]);
+        printf("       %s --soups <n> [--seed <s>] [--threads <t>]\n", argv[0]);
+        printf("       %s --serve [--socket <path>] [--vacuum-at <nodes>]\n", argv[0]);
         return 1;
     }
-    char *filename = argv[1];
-    uint64_t generations = strtoull(argv[2], NULL, 10);
+    char *filename = argv[arg];
+    uint64_t generations = strtoull(argv[arg + 1], NULL, 10);
+    if (trace_file)
+        trace_start(trace_level);
     node_table *table = create_table(INIT_TABLE_SIZE);    
-    node_id pattern = read_rle(table, filename);
-    pattern = advance(table, pattern, generations);
-    char *rle_out = to_rle(table, pattern);
-    printf("%s\n", rle_out);
-    free(rle_out);
+    set_symmetry(table, symmetry);
+    node_id pattern = read_life_file(table, filename);
+    if (rule && set_rule(table, rule))
+    {
+        printf("Unsupported rule: %s\n", rule);
+        return 1;
+    }
+    if (period)
+    {
+        period_info info;
+        if (find_period(table, pattern, generations, &info))
+            printf("period %llu displacement %lld %lld from generation %llu\n", (unsigned long long)info.period,
+                   (long long)info.dx, (long long)info.dy, (unsigned long long)info.first);
+        else
+            printf("no period within %llu generations\n", (unsigned long long)generations);
+    }
+    else if (series_stride)
+    {
+        uint64_t n = generations / series_stride + 1;
+        pop_sample *series = malloc(n * sizeof(pop_sample));
+        n = pop_series(table, pattern, 0, generations, series_stride, series, true);
+        for (uint64_t i = 0; i < n; i++)
+            printf("%llu %llu %lld %lld %lld %lld\n", (unsigned long long)series[i].generation,
+                   (unsigned long long)series[i].pop, (long long)series[i].x0, (long long)series[i].y0,
+                   (long long)series[i].x1, (long long)series[i].y1);
+        free(series);
+    }
+    else
+    {
+        pattern = advance(table, pattern, generations);
+        if (table->rule.alternating && generations & 1)
+            printf("#C %s at an odd generation: the background is on, and the cells shown are off\n", table->rule.name);
+        char *rle_out = to_rle(table, pattern);
+        printf("%s\n", rle_out);
+        free(rle_out);
+    }
+    if (stats)
+        print_stats(table, stderr);
+    if (trace_file)
+        return trace_write_json(trace_file);
     return 0;
-}
\ No newline at end of file
+}
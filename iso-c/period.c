@@ -0,0 +1,139 @@
+#include "period.h"
+
+/* A generation seen so far: its fingerprint, and where the pattern was */
+typedef struct seen_entry
+{
+    node_id key;
+    uint64_t t;
+    int64_t x, y;
+} seen_entry;
+
+/* Open-addressed map from fingerprint node_id to the generation it was seen at,
+    grown as generations are added, so memory follows the history actually stepped */
+typedef struct idmap
+{
+    seen_entry *entries;
+    uint64_t size; // power of 2, kept at least twice the number of entries
+    uint64_t n;
+} idmap;
+
+static bool idmap_init(idmap *map)
+{
+    map->size = 16;
+    map->n = 0;
+    map->entries = calloc(map->size, sizeof(seen_entry));
+    return map->entries != NULL;
+}
+
+static void idmap_free(idmap *map)
+{
+    free(map->entries);
+}
+
+/* Return the entry for key: either holding key, or empty */
+static seen_entry *idmap_slot(idmap *map, node_id key)
+{
+    uint64_t mask = map->size - 1;
+    uint64_t i = mix64(key) & mask;
+    while (map->entries[i].key != UNUSED && map->entries[i].key != key)
+        i = (i + 1) & mask;
+    return &map->entries[i];
+}
+
+/* Make room for one more entry; false if out of memory */
+static bool idmap_reserve(idmap *map)
+{
+    if (2 * (map->n + 1) <= map->size)
+        return true;
+    idmap old = *map;
+    map->entries = calloc(old.size * 2, sizeof(seen_entry));
+    if (!map->entries)
+    {
+        *map = old;
+        return false;
+    }
+    map->size = old.size * 2;
+    for (uint64_t i = 0; i < old.size; i++)
+        if (old.entries[i].key != UNUSED)
+            *idmap_slot(map, old.entries[i].key) = old.entries[i];
+    free(old.entries);
+    return true;
+}
+
+typedef struct fingerprint
+{
+    node_id id; // the pattern, shifted to have its bounding box at (0,0)
+    int64_t x, y;
+} fingerprint;
+
+/* Fingerprint the padded root of a stepper started from a node of the given level */
+static fingerprint take_fingerprint(node_table *table, node_id root, uint64_t start_level)
+{
+    fingerprint f = {table->off, 0, 0};
+    int64_t x0, y0, x1, y1;
+    if (!bounding_box(table, root, &x0, &y0, &x1, &y1))
+        return f;
+    uint64_t level = 0;
+    while ((1LL << level) <= (x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0))
+        level++;
+    f.id = extract(table, root, x0, y0, level);
+    // the stepper keeps the centre fixed; report positions in the original frame
+    int64_t shift = (1LL << (LEVEL(root) - 1)) - (1LL << (start_level - 1));
+    f.x = x0 - shift;
+    f.y = y0 - shift;
+    return f;
+}
+
+/* Step id up to max_generations, looking for a repeat (up to translation).
+    Returns true, and fills in info, if one is found; false if none is, or
+    if memory for the history runs out.
+*/
+bool find_period(node_table *table, node_id id, uint64_t max_generations, period_info *info)
+{
+    stepper st;
+    idmap seen;
+    info->found = false;
+    if (!idmap_init(&seen))
+        return false;
+    stepper_init(table, &st, id, 1);
+    for (uint64_t t = 0; t <= max_generations; t++)
+    {
+        fingerprint f = take_fingerprint(table, st.root, LEVEL(id));
+        // B0 rules store odd generations inverted: the same node at an odd
+        // and an even generation are different patterns, so key the phase too
+        node_id key = table->rule.alternating && t & 1 ? MARK(f.id) : f.id;
+        seen_entry *e = idmap_slot(&seen, key);
+        if (e->key == key)
+        {
+            info->found = true;
+            info->first = e->t;
+            info->period = t - e->t;
+            info->dx = f.x - e->x;
+            info->dy = f.y - e->y;
+            break;
+        }
+        if (!idmap_reserve(&seen))
+            break;
+        *idmap_slot(&seen, key) = (seen_entry){key, t, f.x, f.y};
+        seen.n++;
+        if (t < max_generations)
+            stepper_step(table, &st);
+    }
+    idmap_free(&seen);
+    return info->found;
+}
+
+/* The pattern at generation t of a periodic pattern, without stepping
+    through the cycles. The result is as advance(table, id, t) would give,
+    except moved back by (*dx, *dy), the whole cycles' displacement.
+*/
+node_id period_skip(node_table *table, node_id id, const period_info *info, uint64_t t, int64_t *dx, int64_t *dy)
+{
+    *dx = *dy = 0;
+    if (!info->found || t <= info->first)
+        return advance(table, id, t);
+    uint64_t cycles = (t - info->first) / info->period;
+    *dx = (int64_t)cycles * info->dx;
+    *dy = (int64_t)cycles * info->dy;
+    return advance(table, id, t - cycles * info->period);
+}
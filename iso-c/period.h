@@ -0,0 +1,33 @@
+#ifndef PERIOD_H
+#define PERIOD_H
+#include "hashlife.h"
+
+/* Oscillator and spaceship detection
+
+Nodes are hash-consed, so two generations with the same content, wherever
+it sits, have the same node_id once shifted to a common origin. find_period()
+steps a pattern one generation at a time, fingerprints each generation as
+the extract()ed node at its bounding box corner, and looks the fingerprint
+up in a map of earlier generations, which grows as it goes, so a high
+limit on generations costs nothing up front. The first repeat gives the
+period, the displacement per period and the generation the cycle starts
+(0 for a pure oscillator or spaceship, later for eventually periodic
+patterns). Under B0
+rules, where odd generations are stored inverted, only generations of the
+same parity are matched, so the period is always even.
+
+Once the period is known, period_skip() jumps straight to any generation.
+*/
+
+typedef struct period_info
+{
+    bool found;
+    uint64_t period; // generations per cycle
+    int64_t dx, dy;  // displacement per cycle (0 for oscillators)
+    uint64_t first;  // first generation of the cycle
+} period_info;
+
+bool find_period(node_table *table, node_id id, uint64_t max_generations, period_info *info);
+node_id period_skip(node_table *table, node_id id, const period_info *info, uint64_t t, int64_t *dx, int64_t *dy);
+
+#endif // PERIOD_H
@@ -0,0 +1,634 @@
+/*
+    CPython extension module `hashlife_c`: the C engine behind the same
+    construct() / advance() / expand() API as hashlife.py.
+    Build with `python setup.py build_ext --inplace` from the repository root.
+
+    The module keeps one node_table for the whole process, as hashlife.py
+    keeps one join() cache. Python Node objects wrap a node_id, and every
+    live Node is on a list, so vacuum() frees exactly the nodes that no
+    Python object can reach any more.
+*/
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "hashlife.h"
+#include "cell_io.h"
+#include "timeit.h"
+
+#define PY_TABLE_SIZE (1 << 16)
+#define PY_POLL_NS 100000000ULL // advance()/ffwd() check for KeyboardInterrupt this often
+
+typedef struct NodeObject
+{
+    PyObject_HEAD
+    node_id id;
+    struct NodeObject *prev, *next; // every live Node, for vacuum()
+} NodeObject;
+
+static node_table *table;
+static NodeObject *live_nodes;
+static Py_ssize_t n_live_nodes;
+static PyTypeObject NodeType;
+
+/* Wrap id in a new Node, and put it on the live list */
+static PyObject *wrap(node_id id)
+{
+    NodeObject *self = PyObject_New(NodeObject, &NodeType);
+    if (!self)
+        return NULL;
+    self->id = id;
+    self->prev = NULL;
+    self->next = live_nodes;
+    if (live_nodes)
+        live_nodes->prev = self;
+    live_nodes = self;
+    n_live_nodes++;
+    return (PyObject *)self;
+}
+
+static void node_dealloc(NodeObject *self)
+{
+    if (self->prev)
+        self->prev->next = self->next;
+    else
+        live_nodes = self->next;
+    if (self->next)
+        self->next->prev = self->prev;
+    n_live_nodes--;
+    PyObject_Free(self);
+}
+
+static PyObject *node_child(NodeObject *self, int k)
+{
+    if (LEVEL(self->id) == 0)
+        Py_RETURN_NONE;
+    node *n = lookup(table, self->id);
+    node_id children[4] = {n->a, n->b, n->c, n->d};
+    return wrap(children[k]);
+}
+
+static PyObject *node_get_k(NodeObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromUnsignedLongLong(LEVEL(self->id));
+}
+
+static PyObject *node_get_n(NodeObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromUnsignedLongLong(lookup(table, self->id)->pop);
+}
+
+static PyObject *node_get_hash(NodeObject *self, void *closure)
+{
+    (void)closure;
+    return PyLong_FromUnsignedLongLong(self->id);
+}
+
+static PyObject *node_get_child(NodeObject *self, void *closure)
+{
+    return node_child(self, (int)(intptr_t)closure);
+}
+
+static PyGetSetDef node_getset[] = {
+    {"k", (getter)node_get_k, NULL, "level: the node is 2**k x 2**k cells", NULL},
+    {"n", (getter)node_get_n, NULL, "population", NULL},
+    {"hash", (getter)node_get_hash, NULL, "the C node_id", NULL},
+    {"a", (getter)node_get_child, NULL, "top left child (None at k=0)", (void *)0},
+    {"b", (getter)node_get_child, NULL, "top right child (None at k=0)", (void *)1},
+    {"c", (getter)node_get_child, NULL, "bottom left child (None at k=0)", (void *)2},
+    {"d", (getter)node_get_child, NULL, "bottom right child (None at k=0)", (void *)3},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static Py_hash_t node_hash(NodeObject *self)
+{
+    Py_hash_t h = (Py_hash_t)self->id;
+    return h == -1 ? -2 : h;
+}
+
+/* Nodes are interned, so equal patterns have equal IDs */
+static PyObject *node_richcompare(PyObject *a, PyObject *b, int op)
+{
+    if (!PyObject_TypeCheck(b, &NodeType) || (op != Py_EQ && op != Py_NE))
+        Py_RETURN_NOTIMPLEMENTED;
+    bool same = ((NodeObject *)a)->id == ((NodeObject *)b)->id;
+    return PyBool_FromLong(op == Py_EQ ? same : !same);
+}
+
+static PyObject *node_repr(NodeObject *self)
+{
+    uint64_t k = LEVEL(self->id);
+    PyObject *one = PyLong_FromLong(1), *shift = PyLong_FromUnsignedLongLong(k);
+    PyObject *size = one && shift ? PyNumber_Lshift(one, shift) : NULL;
+    PyObject *repr = size ? PyUnicode_FromFormat("Node k=%llu, %S x %S, population %llu", (unsigned long long)k, size, size,
+                                                 (unsigned long long)lookup(table, self->id)->pop)
+                          : NULL;
+    Py_XDECREF(one);
+    Py_XDECREF(shift);
+    Py_XDECREF(size);
+    return repr;
+}
+
+static PyTypeObject NodeType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "hashlife_c.Node",
+    .tp_doc = "A quadtree node in the module's node table",
+    .tp_basicsize = sizeof(NodeObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)node_dealloc,
+    .tp_repr = (reprfunc)node_repr,
+    .tp_hash = (hashfunc)node_hash,
+    .tp_richcompare = node_richcompare,
+    .tp_getset = node_getset,
+};
+
+/* Node arguments */
+#define NODE_ID(obj) (((NodeObject *)(obj))->id)
+
+static int check_level(PyObject *obj, uint64_t min_level, const char *fn)
+{
+    if (LEVEL(NODE_ID(obj)) < min_level)
+    {
+        PyErr_Format(PyExc_ValueError, "%s() needs a node with k >= %llu", fn, (unsigned long long)min_level);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *py_join(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *a, *b, *c, *d;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!:join", &NodeType, &a, &NodeType, &b, &NodeType, &c, &NodeType, &d))
+        return NULL;
+    uint64_t k = LEVEL(NODE_ID(a));
+    if (LEVEL(NODE_ID(b)) != k || LEVEL(NODE_ID(c)) != k || LEVEL(NODE_ID(d)) != k)
+        return PyErr_Format(PyExc_ValueError, "join() needs four nodes of the same level");
+    return wrap(join(table, NODE_ID(a), NODE_ID(b), NODE_ID(c), NODE_ID(d)));
+}
+
+static PyObject *py_get_zero(PyObject *module, PyObject *args)
+{
+    (void)module;
+    unsigned long long k;
+    if (!PyArg_ParseTuple(args, "K:get_zero", &k))
+        return NULL;
+    if (k > 0xFFFF)
+        return PyErr_Format(PyExc_ValueError, "get_zero() level too large");
+    return wrap(get_zero(table, k));
+}
+
+/* node -> node functions that only need a minimum level */
+#define NODE_FN(name, min_level, expr)                                    \
+    static PyObject *py_##name(PyObject *module, PyObject *args)          \
+    {                                                                     \
+        (void)module;                                                     \
+        PyObject *m;                                                      \
+        if (!PyArg_ParseTuple(args, "O!:" #name, &NodeType, &m))          \
+            return NULL;                                                  \
+        if (check_level(m, min_level, #name))                             \
+            return NULL;                                                  \
+        node_id id = NODE_ID(m);                                          \
+        return expr;                                                      \
+    }
+
+NODE_FN(centre, 1, wrap(centre(table, id)))
+NODE_FN(inner, 2, wrap(inner(table, id)))
+NODE_FN(crop, 0, wrap(crop(table, id)))
+NODE_FN(pad, 1, wrap(pad(table, id)))
+NODE_FN(is_padded, 2, PyBool_FromLong(is_padded(table, id)))
+
+/* successor(m, j=None): the centre of m, 2**j generations on (2**(k-2) if j is None) */
+static PyObject *py_successor(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m, *j_obj = Py_None;
+    if (!PyArg_ParseTuple(args, "O!|O:successor", &NodeType, &m, &j_obj) || check_level(m, 2, "successor"))
+        return NULL;
+    if (j_obj == Py_None)
+        return wrap(successor(table, NODE_ID(m), 0));
+    long long j = PyLong_AsLongLong(j_obj);
+    if (j == -1 && PyErr_Occurred())
+        return NULL;
+    if (j < 0)
+        return PyErr_Format(PyExc_ValueError, "successor() needs j >= 0");
+    return wrap(successor_exact(table, NODE_ID(m), (uint64_t)min(j, 63)));
+}
+
+/* Run a resumable advance to the end, raising KeyboardInterrupt etc. between polls */
+static int run_advance(advance_state *state)
+{
+    while (advance_poll(table, state, now_ns() + PY_POLL_NS) == ADVANCE_RUNNING)
+        if (PyErr_CheckSignals())
+            return -1;
+    return 0;
+}
+
+/* advance(node, n): node advanced exactly n generations, cropped */
+static PyObject *py_advance(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m;
+    unsigned long long n;
+    if (!PyArg_ParseTuple(args, "O!K:advance", &NodeType, &m, &n))
+        return NULL;
+    if (n == 0)
+        return Py_NewRef(m);
+    advance_state state;
+    advance_begin(table, &state, NODE_ID(m), n);
+    state.max_j = 63;
+    if (run_advance(&state))
+        return NULL;
+    return wrap(advance_result(table, &state));
+}
+
+/* ffwd(node, n): take n giant leaps, returning (node, generations). The
+    leaps are taken one at a time, as each can be 2**64 generations or more */
+static PyObject *py_ffwd(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m;
+    unsigned long long n;
+    if (!PyArg_ParseTuple(args, "O!K:ffwd", &NodeType, &m, &n))
+        return NULL;
+    node_id id = NODE_ID(m);
+    PyObject *generations = PyLong_FromLong(0);
+    for (unsigned long long i = 0; i < n && generations; i++)
+    {
+        advance_state state;
+        ffwd_begin(table, &state, id, 1);
+        if (run_advance(&state))
+            Py_CLEAR(generations);
+        else
+        {
+            // a leap of a node at level k + 1 is 2**(k - 1) generations
+            PyObject *one = PyLong_FromLong(1), *shift = PyLong_FromUnsignedLongLong(LEVEL(state.root) - 1);
+            PyObject *gens = one && shift ? PyNumber_Lshift(one, shift) : NULL;
+            Py_SETREF(generations, gens ? PyNumber_Add(generations, gens) : NULL);
+            Py_XDECREF(one);
+            Py_XDECREF(shift);
+            Py_XDECREF(gens);
+            id = state.root;
+        }
+    }
+    return generations ? Py_BuildValue("NN", wrap(crop(table, id)), generations) : NULL;
+}
+
+/* construct(pts): the padded quadtree of the (x, y) cells in pts, moved to start at (0, 0) */
+static PyObject *py_construct(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *pts;
+    if (!PyArg_ParseTuple(args, "O:construct", &pts))
+        return NULL;
+    PyObject *seq = PySequence_Fast(pts, "construct() needs a sequence of (x, y) pairs");
+    if (!seq)
+        return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    int64_t *xy = malloc((n ? n : 1) * 2 * sizeof(int64_t));
+    if (!xy)
+    {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+    for (Py_ssize_t i = 0; i < n; i++)
+    {
+        PyObject *pair = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i), "construct() needs (x, y) pairs");
+        long long x = -1, y = -1;
+        if (pair && PySequence_Fast_GET_SIZE(pair) != 2)
+            PyErr_SetString(PyExc_ValueError, "construct() needs (x, y) pairs");
+        else if (pair)
+        {
+            x = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(pair, 0));
+            y = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(pair, 1));
+        }
+        Py_XDECREF(pair);
+        if (PyErr_Occurred())
+        {
+            free(xy);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        xy[2 * i] = x;
+        xy[2 * i + 1] = y;
+        x0 = min(x0, x), y0 = min(y0, y);
+        x1 = x > x1 ? x : x1, y1 = y > y1 ? y : y1;
+    }
+    Py_DECREF(seq);
+    if (n && ((uint64_t)x1 - (uint64_t)x0 >= (1ULL << 32) || (uint64_t)y1 - (uint64_t)y0 >= (1ULL << 32)))
+    {
+        free(xy);
+        return PyErr_Format(PyExc_OverflowError, "construct() pattern is 2**32 cells or more across");
+    }
+    uint64_t extent = n ? (uint64_t)(x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0) : 0;
+    uint64_t level = 1;
+    while (extent >> level)
+        level++;
+    uint64_t *cells = (uint64_t *)xy;
+    for (Py_ssize_t i = 0; i < n; i++)
+    {
+        cells[2 * i] = (uint64_t)(xy[2 * i] - x0);
+        cells[2 * i + 1] = (uint64_t)(xy[2 * i + 1] - y0);
+    }
+    node_id id = set_cells(table, get_zero(table, level), cells, n);
+    free(xy);
+    return wrap(pad(table, id));
+}
+
+typedef struct expand_args
+{
+    PyObject *out;
+    bool clipped;
+    int64_t clip[4]; // as hashlife.py: (x1, x2, y1, y2)
+    uint64_t level;
+} expand_args;
+
+static int expand_node(expand_args *e, node_id id, int64_t x, int64_t y)
+{
+    node *n = lookup(table, id);
+    if (n->pop == 0)
+        return 0;
+    uint64_t k = LEVEL(id);
+    int64_t size = (int64_t)1 << k;
+    if (e->clipped && (x + size < e->clip[0] || x > e->clip[1] || y + size < e->clip[2] || y > e->clip[3]))
+        return 0;
+    if (k == e->level)
+    {
+        // the gray level of this node
+        double gray = n->pop / ((double)size * (double)size);
+        PyObject *t = Py_BuildValue("LLd", (long long)(x >> k), (long long)(y >> k), gray);
+        int err = !t || PyList_Append(e->out, t);
+        Py_XDECREF(t);
+        return err ? -1 : 0;
+    }
+    int64_t offset = size >> 1;
+    node_id a = n->a, b = n->b, c = n->c, d = n->d; // n does not survive the calls below
+    return expand_node(e, a, x, y) || expand_node(e, b, x + offset, y) ||
+           expand_node(e, c, x, y + offset) || expand_node(e, d, x + offset, y + offset);
+}
+
+/* expand(node, x=0, y=0, clip=None, level=0): (x, y, gray) for every non-empty level-`level` block */
+static PyObject *py_expand(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    (void)module;
+    static char *keywords[] = {"node", "x", "y", "clip", "level", NULL};
+    PyObject *m, *clip = Py_None;
+    long long x = 0, y = 0;
+    unsigned long long level = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|LLOK:expand", keywords, &NodeType, &m, &x, &y, &clip, &level))
+        return NULL;
+    if (LEVEL(NODE_ID(m)) > 61)
+        return PyErr_Format(PyExc_OverflowError, "expand() needs k <= 61; crop() the node first");
+    expand_args e = {.clipped = clip != Py_None, .level = level};
+    if (e.clipped && !PyArg_ParseTuple(clip, "LLLL;clip must be (x1, x2, y1, y2)", (long long *)&e.clip[0],
+                                       (long long *)&e.clip[1], (long long *)&e.clip[2], (long long *)&e.clip[3]))
+        return NULL;
+    if (!(e.out = PyList_New(0)))
+        return NULL;
+    if (expand_node(&e, NODE_ID(m), x, y))
+    {
+        Py_DECREF(e.out);
+        return NULL;
+    }
+    return e.out;
+}
+
+static PyObject *py_set_cell(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m;
+    unsigned long long x, y;
+    int state = 1;
+    if (!PyArg_ParseTuple(args, "O!KK|p:set_cell", &NodeType, &m, &x, &y, &state))
+        return NULL;
+    return wrap(set_cell(table, NODE_ID(m), x, y, state));
+}
+
+static PyObject *py_get_cell(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m;
+    unsigned long long x, y, level = 0;
+    if (!PyArg_ParseTuple(args, "O!KK|K:get_cell", &NodeType, &m, &x, &y, &level))
+        return NULL;
+    return PyFloat_FromDouble(get_cell(table, NODE_ID(m), x, y, level));
+}
+
+/* rasterise(node, x, y, width, height, level=0, out=None): gray levels of the
+    window as a float32 buffer of (height >> level) rows of (width >> level);
+    written into out (e.g. a C-contiguous numpy.float32 array) if it is given,
+    otherwise returned as a new memoryview, which numpy.asarray() wraps without copying */
+static PyObject *py_rasterise(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    (void)module;
+    static char *keywords[] = {"node", "x", "y", "width", "height", "level", "out", NULL};
+    PyObject *m, *out = Py_None;
+    unsigned long long x, y, width, height, level = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!KKKK|KO:rasterise", keywords, &NodeType, &m, &x, &y, &width,
+                                     &height, &level, &out))
+        return NULL;
+    if (level > 63)
+        return PyErr_Format(PyExc_ValueError, "rasterise() level too large");
+    uint64_t w = width >> level, h = height >> level;
+    if (h && w > (uint64_t)PY_SSIZE_T_MAX / sizeof(float) / h)
+        return PyErr_NoMemory();
+    Py_ssize_t bytes = (Py_ssize_t)(w * h * sizeof(float));
+    if (out != Py_None)
+    {
+        Py_buffer view;
+        if (PyObject_GetBuffer(out, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+            return NULL;
+        if (view.len != bytes || view.itemsize != sizeof(float) || !view.format || strcmp(view.format, "f"))
+        {
+            PyBuffer_Release(&view);
+            return PyErr_Format(PyExc_ValueError, "out must be a float32 buffer of %llu x %llu",
+                                (unsigned long long)h, (unsigned long long)w);
+        }
+        rasterise(table, NODE_ID(m), view.buf, w, h, x, y, width, height, level);
+        PyBuffer_Release(&view);
+        return Py_NewRef(out);
+    }
+    PyObject *raw = PyByteArray_FromStringAndSize(NULL, bytes);
+    if (!raw)
+        return NULL;
+    rasterise(table, NODE_ID(m), (float *)PyByteArray_AS_STRING(raw), w, h, x, y, width, height, level);
+    PyObject *view = PyMemoryView_FromObject(raw);
+    Py_DECREF(raw);
+    if (!view)
+        return NULL;
+    PyObject *shaped = PyObject_CallMethod(view, "cast", "s(KK)", "f", (unsigned long long)h, (unsigned long long)w);
+    Py_DECREF(view);
+    return shaped;
+}
+
+/* Wrap a pattern read from a file or string, switching to the rule it named (if any);
+    ValueError, as from set_rule(), if that rule is not supported */
+static PyObject *wrap_read(node_id id, const char *rule)
+{
+    if (rule[0] && set_rule(table, rule))
+        return PyErr_Format(PyExc_ValueError, "unsupported rule: %s", rule);
+    return wrap(id);
+}
+
+/* from_rle(text): the pattern in an RLE string; a rule in its header becomes the module's rule */
+static PyObject *py_from_rle(PyObject *module, PyObject *args)
+{
+    (void)module;
+    const char *rle;
+    char rule[RULE_NAME_LEN];
+    if (!PyArg_ParseTuple(args, "s:from_rle", &rle))
+        return NULL;
+    char *copy = strdup(rle);
+    if (!copy)
+        return PyErr_NoMemory();
+    node_id id = from_rle_rule(table, copy, rule);
+    free(copy);
+    return wrap_read(id, rule);
+}
+
+static PyObject *py_to_rle(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m;
+    if (!PyArg_ParseTuple(args, "O!:to_rle", &NodeType, &m))
+        return NULL;
+    char *rle = to_rle(table, NODE_ID(m));
+    PyObject *result = PyUnicode_FromString(rle);
+    free(rle);
+    return result;
+}
+
+/* read_life(filename): a pattern file in any format read_life_stream() knows */
+static PyObject *py_read_life(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *path;
+    if (!PyArg_ParseTuple(args, "O&:read_life", PyUnicode_FSConverter, &path))
+        return NULL;
+    FILE *f = fopen(PyBytes_AS_STRING(path), "r");
+    if (!f)
+    {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    char rule[RULE_NAME_LEN];
+    node_id id = read_life_stream_rule(table, f, rule);
+    fclose(f);
+    return wrap_read(id, rule);
+}
+
+static PyObject *py_write_rle(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *m, *path;
+    if (!PyArg_ParseTuple(args, "O!O&:write_rle", &NodeType, &m, PyUnicode_FSConverter, &path))
+        return NULL;
+    int err = write_rle(table, NODE_ID(m), PyBytes_AS_STRING(path));
+    if (err)
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+    Py_DECREF(path);
+    if (err)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *py_set_rule(PyObject *module, PyObject *args)
+{
+    (void)module;
+    const char *rule;
+    if (!PyArg_ParseTuple(args, "s:set_rule", &rule))
+        return NULL;
+    if (set_rule(table, rule))
+        return PyErr_Format(PyExc_ValueError, "unsupported rule: %s", rule);
+    Py_RETURN_NONE;
+}
+
+static PyObject *py_get_rule(PyObject *module, PyObject *args)
+{
+    (void)module;
+    (void)args;
+    return PyUnicode_FromString(table->rule.name);
+}
+
+/* vacuum(): free every node not reachable from a live Node; returns the nodes kept */
+static PyObject *py_vacuum(PyObject *module, PyObject *args)
+{
+    (void)module;
+    (void)args;
+    node_id *roots = malloc((n_live_nodes ? n_live_nodes : 1) * sizeof(node_id));
+    if (!roots)
+        return PyErr_NoMemory();
+    uint64_t n_roots = 0;
+    for (NodeObject *n = live_nodes; n; n = n->next)
+        roots[n_roots++] = n->id;
+    vacuum_roots(table, roots, n_roots);
+    free(roots);
+    return PyLong_FromUnsignedLongLong(table->count);
+}
+
+static PyObject *py_node_count(PyObject *module, PyObject *args)
+{
+    (void)module;
+    (void)args;
+    return PyLong_FromUnsignedLongLong(table->count);
+}
+
+static PyMethodDef hashlife_methods[] = {
+    {"join", py_join, METH_VARARGS, "join(a, b, c, d): the node with children a, b, c, d"},
+    {"get_zero", py_get_zero, METH_VARARGS, "get_zero(k): the empty node at level k"},
+    {"centre", py_centre, METH_VARARGS, "centre(m): m centred in a node one level up"},
+    {"inner", py_inner, METH_VARARGS, "inner(m): the central half of m"},
+    {"crop", py_crop, METH_VARARGS, "crop(m): remove empty padding"},
+    {"pad", py_pad, METH_VARARGS, "pad(m): centre m until it is padded"},
+    {"is_padded", py_is_padded, METH_VARARGS, "is_padded(m): only the central quarter of m is occupied"},
+    {"successor", py_successor, METH_VARARGS, "successor(m, j=None): the centre of m, 2**j generations on"},
+    {"advance", py_advance, METH_VARARGS, "advance(node, n): node advanced n generations"},
+    {"ffwd", py_ffwd, METH_VARARGS, "ffwd(node, n): take n giant leaps, returning (node, generations)"},
+    {"construct", py_construct, METH_VARARGS, "construct(pts): the quadtree of a list of (x, y) cells"},
+    {"expand", (PyCFunction)(void (*)(void))py_expand, METH_VARARGS | METH_KEYWORDS,
+     "expand(node, x=0, y=0, clip=None, level=0): list of (x, y, gray)"},
+    {"set_cell", py_set_cell, METH_VARARGS, "set_cell(node, x, y, state=True): node with one cell changed"},
+    {"get_cell", py_get_cell, METH_VARARGS, "get_cell(node, x, y, level=0): gray level at (x, y)"},
+    {"rasterise", (PyCFunction)(void (*)(void))py_rasterise, METH_VARARGS | METH_KEYWORDS,
+     "rasterise(node, x, y, width, height, level=0, out=None): float32 gray levels of a window"},
+    {"from_rle", py_from_rle, METH_VARARGS, "from_rle(text): the pattern in an RLE string"},
+    {"to_rle", py_to_rle, METH_VARARGS, "to_rle(node): node as an RLE string"},
+    {"read_life", py_read_life, METH_VARARGS, "read_life(filename): read an RLE, Life 1.05/1.06 or plaintext file"},
+    {"write_rle", py_write_rle, METH_VARARGS, "write_rle(node, filename): write node as RLE"},
+    {"set_rule", py_set_rule, METH_VARARGS, "set_rule(rule): switch to a rule such as 'B36/S23'"},
+    {"get_rule", py_get_rule, METH_NOARGS, "get_rule(): the current rule"},
+    {"vacuum", py_vacuum, METH_NOARGS, "vacuum(): free nodes no live Node can reach; returns the nodes kept"},
+    {"node_count", py_node_count, METH_NOARGS, "node_count(): nodes in the table"},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef hashlife_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "hashlife_c",
+    .m_doc = "hashlife.py's API on the iso-c engine",
+    .m_size = -1,
+    .m_methods = hashlife_methods,
+};
+
+PyMODINIT_FUNC PyInit_hashlife_c(void)
+{
+    if (PyType_Ready(&NodeType) < 0)
+        return NULL;
+    PyObject *module = PyModule_Create(&hashlife_module);
+    if (!module)
+        return NULL;
+    if (!table)
+        table = create_table(PY_TABLE_SIZE);
+    // on and off are module attributes, as in hashlife.py
+    if (PyModule_AddObjectRef(module, "Node", (PyObject *)&NodeType) < 0 ||
+        PyModule_AddObject(module, "on", wrap(table->on)) < 0 ||
+        PyModule_AddObject(module, "off", wrap(table->off)) < 0)
+    {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,179 @@
+#include "rule.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NEIGHBOURS 495 // every bit but the centre
+
+/* Hensel letters for each neighbour count, and a neighbourhood of each
+   shape (counts 5-7 are the complements of 3-1, with the same letters) */
+static const char *letters[9] = {"", "ce", "ceaikn", "ceaiknjqry", "ceaiknjqrtwyz", "ceaiknjqry", "ceaikn", "ce", ""};
+static const int shapes[5][13] = {
+    {0},
+    {1, 2},
+    {5, 10, 3, 40, 33, 68},
+    {69, 42, 11, 7, 98, 13, 14, 70, 41, 97},
+    {325, 170, 15, 45, 99, 71, 106, 102, 43, 101, 105, 78, 108},
+};
+
+/* Number of live neighbours (not counting the centre) in a neighbourhood */
+static int neighbours(int index)
+{
+    int count = 0;
+    for (int bit = 0; bit < 9; bit++)
+        if (bit != 4 && (index >> bit & 1))
+            count++;
+    return count;
+}
+
+/* The neighbourhood under symmetry t (as transform(): bit 2 swaps x and y,
+   then bit 0 flips x and bit 1 flips y) */
+static int orient(int index, int t)
+{
+    int result = 0;
+    for (int bit = 0; bit < 9; bit++)
+        if (index >> bit & 1)
+        {
+            int x = bit % 3, y = bit / 3;
+            if (t & 4)
+            {
+                int s = x;
+                x = y, y = s;
+            }
+            if (t & 1)
+                x = 2 - x;
+            if (t & 2)
+                y = 2 - y;
+            result |= 1 << (y * 3 + x);
+        }
+    return result;
+}
+
+/* Which of the letters of its neighbour count a neighbourhood has */
+static int shape(int index)
+{
+    int n = neighbours(index), cells = index & NEIGHBOURS;
+    for (int k = 0; letters[n][k]; k++)
+    {
+        int s = n <= 4 ? shapes[n][k] : NEIGHBOURS ^ shapes[8 - n][k];
+        for (int t = 0; t < 8; t++)
+            if (orient(s, t) == cells)
+                return k;
+    }
+    return 0;
+}
+
+/* Every shape of n neighbours, as a bitmask over its letters */
+static int all_shapes(int n)
+{
+    return n == 0 || n == 8 ? 1 : (1 << strlen(letters[n])) - 1;
+}
+
+/* Parse a run of neighbour counts, each optionally followed by Hensel
+   letters (or '-' and the letters to leave out), into one bitmask of
+   shapes per count; returns the end, or NULL if invalid */
+static const char *parse_counts(const char *s, int *counts)
+{
+    for (int n = 0; n < 9; n++)
+        counts[n] = 0;
+    while (isdigit((unsigned char)*s))
+    {
+        int n = *s++ - '0';
+        if (n == 9)
+            return NULL;
+        bool negate = *s == '-';
+        if (negate)
+            s++;
+        int chosen = 0;
+        for (; *s && islower((unsigned char)*s) && strchr("ceaiknjqrtwyz", *s); s++)
+        {
+            const char *letter = strchr(letters[n], *s);
+            if (!letter)
+                return NULL;
+            chosen |= 1 << (letter - letters[n]);
+        }
+        if (negate && !chosen)
+            return NULL;
+        counts[n] |= chosen == 0 ? all_shapes(n) : negate ? all_shapes(n) & ~chosen : chosen;
+    }
+    return s;
+}
+
+/* Write counts in canonical form: letters only when not all shapes are
+   chosen, and the left-out letters instead when that is shorter */
+static char *write_counts(char *p, const int *counts)
+{
+    for (int n = 0; n <= 8; n++)
+    {
+        if (!counts[n])
+            continue;
+        *p++ = '0' + n;
+        if (counts[n] == all_shapes(n))
+            continue;
+        int len = (int)strlen(letters[n]), chosen = 0;
+        for (int k = 0; k < len; k++)
+            chosen += counts[n] >> k & 1;
+        bool negate = chosen * 2 > len;
+        if (negate)
+            *p++ = '-';
+        for (int k = 0; k < len; k++)
+            if ((counts[n] >> k & 1) != negate)
+                *p++ = letters[n][k];
+    }
+    return p;
+}
+
+/* Compile a rule from its text (Bx/Sy, BxSy or Sy/Bx, with optional Hensel
+   letters); returns 0 on success, -1 if invalid */
+int parse_rule(const char *text, life_rule *rule)
+{
+    int birth[9], survival[9];
+    bool have_birth = false, have_survival = false;
+    const char *s = text;
+    while (isspace((unsigned char)*s))
+        s++;
+    if (isdigit((unsigned char)*s) || *s == '/')
+    {
+        // S/B: survival counts, a slash, birth counts
+        if (!(s = parse_counts(s, survival)) || *s++ != '/' || !(s = parse_counts(s, birth)))
+            return -1;
+        have_birth = have_survival = true;
+    }
+    else
+        while (*s && !isspace((unsigned char)*s))
+        {
+            char kind = toupper((unsigned char)*s++);
+            bool *seen = kind == 'B' ? &have_birth : kind == 'S' ? &have_survival : NULL;
+            if (!seen || *seen || !(s = parse_counts(s, kind == 'B' ? birth : survival)))
+                return -1;
+            *seen = true;
+            if (*s == '/')
+                s++;
+        }
+    while (isspace((unsigned char)*s))
+        s++;
+    if (*s || !have_birth || !have_survival)
+        return -1;
+    rule->alternating = birth[0] != 0;
+    if (rule->alternating && survival[8]) // the background would stay on
+        return -1;
+
+    for (int index = 0; index < 512; index++)
+    {
+        int n = neighbours(index), k = shape(index);
+        rule->next[index] = ((index & RULE_CENTRE) ? survival[n] : birth[n]) >> k & 1;
+    }
+    for (int index = 0; index < 512; index++)
+    {
+        rule->phase[0][index] = rule->alternating ? !rule->next[index] : rule->next[index];
+        rule->phase[1][index] = rule->alternating ? rule->next[511 ^ index] : rule->next[index];
+    }
+    char *p = rule->name;
+    *p++ = 'B';
+    p = write_counts(p, birth);
+    *p++ = '/';
+    *p++ = 'S';
+    p = write_counts(p, survival);
+    *p = 0;
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef RULE_H
+#define RULE_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Life-like and isotropic non-totalistic rules
+
+A rule is compiled once into a 512 entry table giving the next state of
+a cell for each 3x3 neighbourhood, so the base case (life_4x4) does a
+table lookup per cell, with no branches on the rule.
+
+Neighbourhoods are indexed row-major, top left in bit 0 and the centre
+cell in bit 4 (value 16):
+
+    1   2   4
+    8  16  32
+   64 128 256
+
+Rules are written Bx/Sy (B3/S23), or in the older S/B form (23/3).
+Each neighbour count may be followed by Hensel letters, selecting only
+some shapes of that many neighbours (B2a/S12-e: birth on two adjacent
+neighbours, survival on one, or on two except when edge-adjacent).
+Rules are isotropic: each letter covers every rotation and reflection.
+
+-- B0 --
+With B0 the empty background turns on every generation, which an
+infinite plane cannot store. Without S8 it turns off again the next
+generation, so the engine uses alternating phase tables instead: even
+generations compute the complement of the next state, odd generations
+take complemented cells back to true ones. The stored background is then
+always off, but patterns at odd generations are stored inverted (a
+stored cell is on when the true cell is off). B0 with S8 would leave the
+background on for good, and is rejected.
+*/
+
+#define RULE_NAME_LEN 128
+#define RULE_CENTRE 16
+
+typedef struct life_rule
+{
+    uint8_t next[512];        // next state for each neighbourhood
+    uint8_t phase[2][512];    // the tables used at even and odd generations
+    bool alternating;         // B0: odd generations are stored inverted
+    char name[RULE_NAME_LEN]; // canonical Bx/Sy name
+} life_rule;
+
+int parse_rule(const char *text, life_rule *rule);
+
+#endif // RULE_H
@@ -0,0 +1,278 @@
+/*
+    Subpattern search over the hash-consed tree; see search.h.
+*/
+#include "search.h"
+#include "trace.h"
+
+enum
+{
+    INSIDE,
+    HSEAM,
+    VSEAM,
+    CORNER
+};
+
+/* Memoised match counts, open-addressed on (kind, up to four IDs) */
+typedef struct memo_entry
+{
+    node_id ids[4];
+    uint64_t kind;
+    uint64_t count;
+} memo_entry;
+
+typedef struct search
+{
+    node_table *table;
+    uint64_t block; // B: the window fits in 2^B cells
+    uint64_t w, h;  // window size
+    uint64_t rows[SEARCH_MAX_SIZE];
+    uint64_t row_mask;
+    uint64_t margin;
+    uint64_t pop; // live cells in the target
+    int t;        // orientation being searched for
+    memo_entry *memo;
+    uint64_t memo_size, memo_count;
+    match_callback emit;
+    void *ctx;
+} search;
+
+static uint64_t memo_hash(uint64_t kind, const node_id *ids)
+{
+    return mix64(hash_quad(ids[0], ids[1], ids[2], ids[3]) ^ kind);
+}
+
+/* The slot for (kind, ids): either holding it, or empty */
+static memo_entry *memo_slot(search *s, uint64_t kind, const node_id *ids)
+{
+    uint64_t mask = s->memo_size - 1;
+    uint64_t i = memo_hash(kind, ids) & mask;
+    memo_entry *e = &s->memo[i];
+    while (e->ids[0] != UNUSED && (e->kind != kind || memcmp(e->ids, ids, sizeof(e->ids))))
+        e = &s->memo[++i & mask];
+    return e;
+}
+
+static void memo_store(search *s, uint64_t kind, const node_id *ids, uint64_t count)
+{
+    if (2 * (s->memo_count + 1) > s->memo_size)
+    {
+        memo_entry *old = s->memo;
+        uint64_t old_size = s->memo_size;
+        s->memo_size *= 2;
+        s->memo = calloc(s->memo_size, sizeof(memo_entry));
+        for (uint64_t i = 0; i < old_size; i++)
+            if (old[i].ids[0] != UNUSED)
+                *memo_slot(s, old[i].kind, old[i].ids) = old[i];
+        free(old);
+    }
+    memo_entry *e = memo_slot(s, kind, ids);
+    if (e->ids[0] == UNUSED)
+        s->memo_count++;
+    memcpy(e->ids, ids, sizeof(e->ids));
+    e->kind = kind;
+    e->count = count;
+}
+
+static uint64_t pop_of(search *s, node_id id)
+{
+    return lookup(s->table, id)->pop;
+}
+
+static node child(search *s, node_id id)
+{
+    return *lookup(s->table, id);
+}
+
+/* Matches in the 2x2 group of level-B blocks q (a, b, c, d) with its corner at (x, y),
+    reported if emit is set */
+static uint64_t base(search *s, const node_id *q, int64_t x, int64_t y, bool emit)
+{
+    uint64_t size = 1ULL << s->block;
+    uint64_t rows[2 * SEARCH_MAX_SIZE] = {0};
+    int64_t xy[2 * 64];
+    for (int k = 0; k < 4; k++)
+    {
+        if (pop_of(s, q[k]) == 0)
+            continue;
+        cell_iter it;
+        uint64_t n;
+        cell_iter_init(s->table, &it, q[k], (k & 1) * size, (k >> 1) * size);
+        while ((n = cell_iter_next(&it, xy, 64)))
+            for (uint64_t i = 0; i < n; i++)
+                rows[xy[2 * i + 1]] |= 1ULL << xy[2 * i];
+    }
+    uint64_t count = 0;
+    for (uint64_t oy = 0; oy < size; oy++)
+        for (uint64_t ox = 0; ox < size; ox++)
+        {
+            uint64_t r = 0;
+            while (r < s->h && ((rows[oy + r] >> ox) & s->row_mask) == s->rows[r])
+                r++;
+            if (r == s->h)
+            {
+                count++;
+                if (emit)
+                    s->emit(s->ctx, x + ox + s->margin, y + oy + s->margin, s->t);
+            }
+        }
+    return count;
+}
+
+static uint64_t corner(search *s, node_id a, node_id b, node_id c, node_id d, int64_t x, int64_t y, bool emit);
+static uint64_t hseam(search *s, node_id l, node_id r, int64_t x, int64_t y, bool emit);
+static uint64_t vseam(search *s, node_id t, node_id b, int64_t x, int64_t y, bool emit);
+
+/* Count (or, if emit is set, report) the matches of one kind of region;
+    counts are memoised, and reporting only descends where the count is non-zero */
+#define MEMOISED(kind, key, total_pop, body)                     \
+    do                                                           \
+    {                                                            \
+        if ((total_pop) < s->pop)                                \
+            return 0;                                            \
+        memo_entry *e = memo_slot(s, kind, key);                 \
+        if (e->ids[0] != UNUSED && (!emit || e->count == 0))     \
+            return e->count;                                     \
+        uint64_t count = (body);                                 \
+        if (!emit)                                               \
+            memo_store(s, kind, key, count);                     \
+        return count;                                            \
+    } while (0)
+
+/* Groups containing the centre point of four level-m nodes, a at (x, y) */
+static uint64_t corner(search *s, node_id a, node_id b, node_id c, node_id d, int64_t x, int64_t y, bool emit)
+{
+    node_id q[4] = {a, b, c, d};
+    uint64_t level = LEVEL(a);
+    if (level == s->block)
+        MEMOISED(CORNER, q, pop_of(s, a) + pop_of(s, b) + pop_of(s, c) + pop_of(s, d), base(s, q, x, y, emit));
+    int64_t half = 1LL << (level - 1);
+    MEMOISED(CORNER, q, pop_of(s, a) + pop_of(s, b) + pop_of(s, c) + pop_of(s, d),
+             corner(s, child(s, a).d, child(s, b).c, child(s, c).b, child(s, d).a, x + half, y + half, emit));
+}
+
+/* Groups straddling the seam between l and r side by side, l at (x, y) */
+static uint64_t hseam(search *s, node_id l, node_id r, int64_t x, int64_t y, bool emit)
+{
+    node_id q[4] = {l, r, UNUSED + 1, UNUSED + 1};
+    uint64_t level = LEVEL(l);
+    if (level == s->block)
+        return 0;
+    int64_t half = 1LL << (level - 1);
+    node ln = child(s, l), rn = child(s, r);
+    MEMOISED(HSEAM, q, ln.pop + rn.pop,
+             hseam(s, ln.b, rn.a, x + half, y, emit) + hseam(s, ln.d, rn.c, x + half, y + half, emit) +
+                 corner(s, ln.b, rn.a, ln.d, rn.c, x + half, y, emit));
+}
+
+/* Groups straddling the seam between t above b, t at (x, y) */
+static uint64_t vseam(search *s, node_id t, node_id b, int64_t x, int64_t y, bool emit)
+{
+    node_id q[4] = {t, b, UNUSED + 1, UNUSED + 1};
+    uint64_t level = LEVEL(t);
+    if (level == s->block)
+        return 0;
+    int64_t half = 1LL << (level - 1);
+    node tn = child(s, t), bn = child(s, b);
+    MEMOISED(VSEAM, q, tn.pop + bn.pop,
+             vseam(s, tn.c, bn.a, x, y + half, emit) + vseam(s, tn.d, bn.b, x + half, y + half, emit) +
+                 corner(s, tn.c, tn.d, bn.a, bn.b, x, y + half, emit));
+}
+
+/* Groups wholly inside id (of level B+1 or more), at (x, y) */
+static uint64_t inside(search *s, node_id id, int64_t x, int64_t y, bool emit)
+{
+    node_id q[4] = {id, UNUSED + 1, UNUSED + 1, UNUSED + 1};
+    node n = child(s, id);
+    if (LEVEL(id) == s->block + 1)
+        return corner(s, n.a, n.b, n.c, n.d, x, y, emit);
+    int64_t half = 1LL << (LEVEL(id) - 1);
+    MEMOISED(INSIDE, q, n.pop,
+             inside(s, n.a, x, y, emit) + inside(s, n.b, x + half, y, emit) + inside(s, n.c, x, y + half, emit) +
+                 inside(s, n.d, x + half, y + half, emit) + hseam(s, n.a, n.b, x, y, emit) +
+                 hseam(s, n.c, n.d, x, y + half, emit) + vseam(s, n.a, n.c, x, y, emit) +
+                 vseam(s, n.b, n.d, x + half, y, emit) + corner(s, n.a, n.b, n.c, n.d, x, y, emit));
+}
+
+/* Set up the window of the target under transform t; false if it is empty or too large */
+static bool prepare(search *s, node_id target, uint64_t margin, int t)
+{
+    int64_t x0, y0, x1, y1;
+    target = transform(s->table, target, t);
+    if (!bounding_box(s->table, target, &x0, &y0, &x1, &y1))
+        return false;
+    s->t = t;
+    s->margin = margin;
+    s->w = (uint64_t)(x1 - x0 + 1) + 2 * margin;
+    s->h = (uint64_t)(y1 - y0 + 1) + 2 * margin;
+    if (s->w > SEARCH_MAX_SIZE || s->h > SEARCH_MAX_SIZE)
+        return false;
+    s->block = 1;
+    while ((1ULL << s->block) < (s->w > s->h ? s->w : s->h))
+        s->block++;
+    s->row_mask = (1ULL << s->w) - 1;
+    s->pop = lookup(s->table, target)->pop;
+    memset(s->rows, 0, sizeof(s->rows));
+    cell_iter it;
+    int64_t xy[2 * 64];
+    uint64_t n;
+    cell_iter_init(s->table, &it, target, (int64_t)margin - x0, (int64_t)margin - y0);
+    while ((n = cell_iter_next(&it, xy, 64)))
+        for (uint64_t i = 0; i < n; i++)
+            s->rows[xy[2 * i + 1]] |= 1ULL << xy[2 * i];
+    return true;
+}
+
+/* Find every occurrence of target (its bounding box, with margin dead cells
+    around it) in universe, in all eight orientations if asked. Each is passed
+    to emit (if not NULL). Returns the number found, or SEARCH_TOO_LARGE if the
+    window is more than SEARCH_MAX_SIZE cells on a side. Orientations that
+    look the same (as for a symmetric target) are only reported once, under
+    the lowest t.
+*/
+uint64_t find_pattern(node_table *table, node_id universe, node_id target, uint64_t margin, bool orientations,
+                      match_callback emit, void *ctx)
+{
+    TRACE_BEGIN(t0, true);
+    search s = {.table = table, .emit = emit, .ctx = ctx};
+    uint64_t seen_rows[8][SEARCH_MAX_SIZE], seen_w[8], seen_h[8];
+    int n_seen = 0;
+    uint64_t total = 0;
+    for (int t = 0; t < (orientations ? 8 : 1); t++)
+    {
+        if (!prepare(&s, target, margin, t))
+        {
+            if (s.w > SEARCH_MAX_SIZE || s.h > SEARCH_MAX_SIZE)
+                total = SEARCH_TOO_LARGE;
+            break;
+        }
+        bool repeat = false;
+        for (int i = 0; i < n_seen && !repeat; i++)
+            repeat = seen_w[i] == s.w && seen_h[i] == s.h && !memcmp(seen_rows[i], s.rows, sizeof(s.rows));
+        if (repeat)
+            continue;
+        memcpy(seen_rows[n_seen], s.rows, sizeof(s.rows));
+        seen_w[n_seen] = s.w;
+        seen_h[n_seen++] = s.h;
+
+        // centre the universe in empty space, so windows over its edges are found too
+        node_id root = universe;
+        int64_t offset = 0;
+        if (LEVEL(root) == 0)
+            root = join(table, root, table->off, table->off, table->off);
+        do
+        {
+            offset += 1LL << (LEVEL(root) - 1);
+            root = centre(table, root);
+        } while (LEVEL(root) < s.block + 1);
+        s.memo_size = 1024;
+        s.memo_count = 0;
+        s.memo = calloc(s.memo_size, sizeof(memo_entry));
+        uint64_t found = inside(&s, root, -offset, -offset, false);
+        if (found && emit)
+            inside(&s, root, -offset, -offset, true);
+        free(s.memo);
+        total += found;
+    }
+    TRACE_END(t0, "find_pattern", LEVEL(universe), "matches", total);
+    return total;
+}
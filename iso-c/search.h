@@ -0,0 +1,37 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+#include "hashlife.h"
+
+/* Subpattern search
+
+find_pattern() reports every place a small target pattern occurs in a
+universe, at any cell offset, without expanding the universe to cells.
+
+The target's window (its bounding box, grown by `margin` empty cells on
+each side) fits in a block of 2^B cells. Wherever it sits, it lies inside
+some 2x2 group of aligned 2^B blocks, with its corner in the top left
+block. The groups of a node are those inside each child, those straddling
+each of the four seams between children, and the one at the centre, and
+a seam's groups split the same way. So the count of matches is memoised
+on the IDs of the nodes (and pairs and quads of nodes along seams), and a
+repeated subtree is searched once, however often it occurs: the cost is
+in proportion to the distinct nodes, not the area. Subtrees with fewer
+live cells than the target are skipped outright. Only the groups that
+matched are then walked again to report positions.
+
+A match is an exact match of the window: the target's cells live, every
+other cell of the window dead. Cells outside the window are not looked
+at, so with margin 0 a block is found inside a larger still life too.
+*/
+
+#define SEARCH_MAX_SIZE 32 // largest window (target plus margins) on a side
+#define SEARCH_TOO_LARGE UINT64_MAX
+
+/* One match: the target, transformed by t (see transform()), has its
+    bounding box corner at (x, y) in the universe's frame */
+typedef void (*match_callback)(void *ctx, int64_t x, int64_t y, int t);
+
+uint64_t find_pattern(node_table *table, node_id universe, node_id target, uint64_t margin, bool orientations,
+                      match_callback emit, void *ctx);
+
+#endif // SEARCH_H
@@ -0,0 +1,231 @@
+/*
+    Warm, long-running server mode; see serve.h for the command set.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "serve.h"
+#include "cell_io.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+void serve_init(server *srv, node_table *table)
+{
+    srv->table = table;
+    srv->n_jobs = 0;
+    srv->auto_vacuum = 0;
+}
+
+static serve_job *find_job(server *srv, const char *name)
+{
+    for (int i = 0; i < srv->n_jobs; i++)
+        if (!strcmp(srv->jobs[i].name, name))
+            return &srv->jobs[i];
+    return NULL;
+}
+
+/* Vacuum, keeping every pinned root */
+static void serve_vacuum(server *srv)
+{
+    node_id roots[SERVE_MAX_JOBS];
+    for (int i = 0; i < srv->n_jobs; i++)
+        roots[i] = srv->jobs[i].root;
+    vacuum_roots(srv->table, roots, srv->n_jobs);
+}
+
+/* A file the server may write: relative, and not leaving its working
+    directory, since a socket client is not necessarily its owner */
+static bool writable_path(const char *path)
+{
+    if (path[0] == '/')
+        return false;
+    for (const char *p = path; (p = strstr(p, "..")); p += 2)
+        if ((p == path || p[-1] == '/') && (p[2] == '/' || p[2] == '\0'))
+            return false;
+    return true;
+}
+
+/* Write a job as RLE, noting if it is stored inverted (a B0 rule at an odd generation) */
+static void write_job(server *srv, serve_job *job, FILE *f)
+{
+    if (srv->table->rule.alternating && job->generation & 1)
+        fprintf(f, "#C %s at an odd generation: the background is on, and the cells shown are off\n",
+                srv->table->rule.name);
+    char *rle = to_rle(srv->table, job->root);
+    fputs(rle, f);
+    free(rle);
+}
+
+/* Handle one command line, writing the reply to out.
+   Returns SERVE_CONTINUE, SERVE_QUIT or SERVE_SHUTDOWN. */
+int serve_command(server *srv, char *line, FILE *out)
+{
+    char *cmd = strtok(line, " \t\r\n");
+    char *name = strtok(NULL, " \t\r\n");
+    char *arg = strtok(NULL, " \t\r\n");
+    serve_job *job = name ? find_job(srv, name) : NULL;
+
+    if (!cmd)
+        return SERVE_CONTINUE;
+    if (!strcmp(cmd, "quit"))
+    {
+        fprintf(out, "ok bye\n");
+        return SERVE_QUIT;
+    }
+    if (!strcmp(cmd, "shutdown"))
+    {
+        fprintf(out, "ok shutdown\n");
+        return SERVE_SHUTDOWN;
+    }
+    if (!strcmp(cmd, "stats"))
+    {
+        print_stats(srv->table, out);
+        fprintf(out, "ok\n");
+    }
+    else if (!strcmp(cmd, "vacuum"))
+    {
+        serve_vacuum(srv);
+        fprintf(out, "ok %llu nodes\n", (unsigned long long)srv->table->count);
+    }
+    else if (!strcmp(cmd, "load") && name && arg)
+    {
+        FILE *f = fopen(arg, "r");
+        char rule_name[RULE_NAME_LEN];
+        life_rule rule;
+        node_id root = UNUSED;
+        if (f)
+        {
+            // the pattern does not depend on the rule, so leave the table's (and its cache) alone
+            root = read_life_stream_rule(srv->table, f, rule_name);
+            fclose(f);
+        }
+        if (!f)
+            fprintf(out, "error cannot open %s\n", arg);
+        else if (parse_rule(rule_name[0] ? rule_name : "B3/S23", &rule))
+            fprintf(out, "error unsupported rule %s\n", rule_name);
+        else if (!job && srv->n_jobs == SERVE_MAX_JOBS)
+            fprintf(out, "error too many jobs\n");
+        else if (strlen(name) >= SERVE_NAME_LEN)
+            fprintf(out, "error name too long\n");
+        else
+        {
+            if (!job)
+            {
+                job = &srv->jobs[srv->n_jobs++];
+                strcpy(job->name, name);
+            }
+            job->root = root;
+            job->generation = 0;
+            strcpy(job->rule, rule.name);
+            fprintf(out, "ok level %llu population %llu\n", (unsigned long long)LEVEL(job->root),
+                    (unsigned long long)lookup(srv->table, job->root)->pop);
+        }
+    }
+    else if (!strcmp(cmd, "load") || !strcmp(cmd, "advance") || !strcmp(cmd, "write") ||
+             !strcmp(cmd, "info") || !strcmp(cmd, "drop"))
+    {
+        if (!strcmp(cmd, "load"))
+            fprintf(out, "error missing argument to load\n");
+        else if (!job)
+            fprintf(out, "error no job %s\n", name ? name : "(missing name)");
+        else if ((!strcmp(cmd, "advance") || !strcmp(cmd, "write")) && set_rule(srv->table, job->rule))
+            fprintf(out, "error cannot switch to rule %s\n", job->rule);
+        else if (!strcmp(cmd, "advance") && arg)
+        {
+            uint64_t steps = strtoull(arg, NULL, 10);
+            advance_state state;
+            advance_begin(srv->table, &state, job->root, steps);
+            state.generations = job->generation; // so a B0 rule carries on in the job's phase
+            state.max_j = 63;
+            advance_poll(srv->table, &state, 0);
+            job->root = advance_result(srv->table, &state);
+            job->generation += steps;
+            fprintf(out, "ok level %llu population %llu\n", (unsigned long long)LEVEL(job->root),
+                    (unsigned long long)lookup(srv->table, job->root)->pop);
+        }
+        else if (!strcmp(cmd, "write"))
+        {
+            FILE *w = !arg ? out : writable_path(arg) ? fopen(arg, "w") : NULL;
+            if (!w)
+                fprintf(out, "error cannot write %s\n", arg);
+            else
+            {
+                write_job(srv, job, w);
+                if (arg)
+                    fclose(w);
+                fprintf(out, "%sok\n", arg ? "" : "\n");
+            }
+        }
+        else if (!strcmp(cmd, "info"))
+            fprintf(out, "ok level %llu population %llu generation %llu\n", (unsigned long long)LEVEL(job->root),
+                    (unsigned long long)lookup(srv->table, job->root)->pop, (unsigned long long)job->generation);
+        else if (!strcmp(cmd, "drop"))
+        {
+            *job = srv->jobs[--srv->n_jobs];
+            fprintf(out, "ok\n");
+        }
+        else
+            fprintf(out, "error missing argument to %s\n", cmd);
+    }
+    else
+        fprintf(out, "error unknown command %s\n", cmd);
+
+    if (srv->auto_vacuum && srv->table->count >= srv->auto_vacuum)
+        serve_vacuum(srv);
+    return SERVE_CONTINUE;
+}
+
+/* Serve commands from a stream until quit, shutdown or end of input */
+int serve_stream(server *srv, FILE *in, FILE *out)
+{
+    char line[SERVE_LINE_LEN];
+    int result = SERVE_CONTINUE;
+    while (result == SERVE_CONTINUE && fgets(line, sizeof(line), in))
+    {
+        result = serve_command(srv, line, out);
+        fflush(out);
+    }
+    return result;
+}
+
+/* Serve connections on a UNIX socket, one at a time, until shutdown */
+int serve_socket(server *srv, const char *path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Failed to create socket: %s\n", path);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        printf("Failed to listen on socket: %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    int result = SERVE_CONTINUE;
+    while (result != SERVE_SHUTDOWN)
+    {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+            continue;
+        FILE *in = fdopen(conn, "r");
+        FILE *out = fdopen(dup(conn), "w");
+        if (in && out)
+            result = serve_stream(srv, in, out);
+        if (out)
+            fclose(out);
+        if (in)
+            fclose(in);
+        else
+            close(conn);
+    }
+    close(fd);
+    unlink(path);
+    return 0;
+}
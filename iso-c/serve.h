@@ -0,0 +1,63 @@
+#ifndef SERVE_H
+#define SERVE_H
+#include "hashlife.h"
+
+/* Warm server mode
+
+Keeps one node_table, and with it the successor cache, alive across many
+jobs, so related patterns reuse all earlier memoisation. Each job's root
+is pinned by name, and survives vacuum until it is dropped. A job keeps
+its generation, so under a B0 rule each advance starts in the right
+phase; a job at an odd generation is stored (and written) inverted, with
+a #C line saying so.
+
+Commands are read one per line, from stdin or a local UNIX socket. Every
+reply ends with a line starting "ok" or "error". Anyone who can connect to
+the socket can read any file the server can (with load), and write into
+its working directory, so keep the socket somewhere private.
+
+    load <name> <file>        read a pattern (and its rule) and pin it as job <name>
+    advance <name> <n>        advance job <name> by n generations
+    write <name> [file.rle]   write job <name> as RLE (into the reply if no file);
+                              the file must be under the working directory
+    info <name>               level, population and generation of job <name>
+    drop <name>               unpin job <name>
+    vacuum                    free every node not reachable from a pinned job
+    stats                     print engine statistics
+    quit                      end the session (on a socket, the connection)
+    shutdown                  stop the server
+*/
+
+#define SERVE_MAX_JOBS 1024
+#define SERVE_NAME_LEN 64
+#define SERVE_LINE_LEN 4096
+
+typedef struct serve_job
+{
+    char name[SERVE_NAME_LEN];
+    char rule[RULE_NAME_LEN]; // the table is switched to this rule to advance the job
+    node_id root;
+    uint64_t generation; // generations advanced since load (its parity matters under B0 rules)
+} serve_job;
+
+typedef struct server
+{
+    node_table *table;
+    serve_job jobs[SERVE_MAX_JOBS];
+    int n_jobs;
+    uint64_t auto_vacuum; // vacuum after a command once the table holds this many nodes (0 = never)
+} server;
+
+enum
+{
+    SERVE_CONTINUE,
+    SERVE_QUIT,
+    SERVE_SHUTDOWN
+};
+
+void serve_init(server *srv, node_table *table);
+int serve_command(server *srv, char *line, FILE *out);
+int serve_stream(server *srv, FILE *in, FILE *out);
+int serve_socket(server *srv, const char *path);
+
+#endif // SERVE_H
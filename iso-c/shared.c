@@ -0,0 +1,159 @@
+/*
+    Node tables in POSIX shared memory; see shared.h.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "shared.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The header is padded to whole pages, and the index follows it */
+static uint64_t header_bytes(void)
+{
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    return (sizeof(shared_header) + page - 1) / page * page;
+}
+
+/* Set up a new shared table's header and base nodes */
+static void init_shared(node_table *table, shared_header *h, uint64_t size, const life_rule *rule)
+{
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&h->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&h->changed, &cattr);
+    pthread_condattr_destroy(&cattr);
+    h->size = size;
+    strcpy(h->rule, rule->name);
+    uint64_t mask = size - 1;
+    table->index[table->off & mask] = (node){.pop = 0, .id = table->off};
+    table->index[table->on & mask] = (node){.pop = 1, .id = table->on};
+    h->count = 2;
+    h->attached = 1;
+    __atomic_store_n(&h->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Open the shared table called name (e.g. "/hashlife"), creating it with
+    size slots (rounded up to a power of 2) and the given rule (NULL for
+    B3/S23) if it does not exist yet; if it does, size and rule are taken
+    from it. Returns NULL on failure. free_table() detaches.
+*/
+node_table *open_shared_table(const char *name, uint64_t size, const char *rule)
+{
+    life_rule parsed;
+    uint64_t slots = 16;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool creator = fd >= 0;
+    if (creator)
+    {
+        while (slots < size)
+            slots *= 2;
+        if (parse_rule(rule ? rule : "B3/S23", &parsed) ||
+            ftruncate(fd, (off_t)(header_bytes() + slots * sizeof(node))))
+        {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    }
+    else if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0)) < 0)
+        return NULL;
+
+    // the creator may not have sized it yet
+    struct stat st;
+    while (!fstat(fd, &st) && st.st_size == 0)
+        sched_yield();
+    void *base = (uint64_t)st.st_size > header_bytes()
+                     ? mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                     : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    // a private table, whose index is swapped for the shared one
+    shared_header *h = (shared_header *)base;
+    node_table *table = create_table(16);
+    table_mem_free(&table->mem);
+    table->mem = (table_mem){.ptr = base,
+                             .bytes = (uint64_t)st.st_size,
+                             .page_size = (uint64_t)sysconf(_SC_PAGESIZE),
+                             .method = METHOD_MMAP};
+    table->index = (node *)((char *)base + header_bytes());
+    table->shared = h;
+    if (creator)
+        init_shared(table, h, slots, &parsed);
+    else
+    {
+        while (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC)
+            sched_yield();
+        pthread_mutex_lock(&h->lock);
+        while (h->arrived) // not in the middle of a vacuum
+            pthread_cond_wait(&h->changed, &h->lock);
+        h->attached++;
+        pthread_mutex_unlock(&h->lock);
+    }
+    table->size = h->size;
+    table->count = h->count;
+    parse_rule(h->rule, &table->rule);
+    return table;
+}
+
+/* Detach from a shared table (the same as free_table()); it lives on
+    until unlink_shared_table() and the last process detaches */
+void close_shared_table(node_table *table)
+{
+    shared_header *h = table->shared;
+    pthread_mutex_lock(&h->lock);
+    h->attached--;
+    pthread_cond_broadcast(&h->changed); // a vacuum may have been waiting for this process only
+    pthread_mutex_unlock(&h->lock);
+    table_mem_free(&table->mem);
+    free(table);
+}
+
+/* Remove the name; returns -1 if there was no such table */
+int unlink_shared_table(const char *name)
+{
+    return shm_unlink(name);
+}
+
+/* Give way to a process that is filling in a slot */
+void shared_wait(void)
+{
+    sched_yield();
+}
+
+/* Vacuum a shared table, keeping this process's roots; returns once every
+    attached process has called it (see shared.h) */
+void shared_vacuum(node_table *table, const node_id *roots, uint64_t n_roots)
+{
+    shared_header *h = table->shared;
+    pthread_mutex_lock(&h->lock);
+    uint64_t gen = h->vacuum_gen;
+    h->arrived++;
+    pthread_cond_broadcast(&h->changed);
+    // nodes can only be marked once no process is adding any
+    while (h->arrived < h->attached)
+        pthread_cond_wait(&h->changed, &h->lock);
+    for (uint64_t r = 0; r < n_roots; r++)
+        set_flag(table, roots[r]);
+    if (++h->marked >= h->attached)
+    {
+        vacuum_marked(table);
+        h->arrived = h->marked = 0;
+        h->vacuum_gen++;
+        pthread_cond_broadcast(&h->changed);
+    }
+    else
+        while (h->vacuum_gen == gen)
+            pthread_cond_wait(&h->changed, &h->lock);
+    table->count = h->count;
+    pthread_mutex_unlock(&h->lock);
+}
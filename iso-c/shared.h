@@ -0,0 +1,69 @@
+#ifndef SHARED_H
+#define SHARED_H
+#include "hashlife.h"
+#include <pthread.h>
+
+/* Shared-memory node tables
+
+open_shared_table() maps a node table into a named POSIX shared memory
+object, so that several processes on one machine build on one set of
+nodes and one successor cache. A pool of worker processes then computes
+each subtree once between them, not once each.
+
+The mapping holds a header and the index, and nothing else. The index
+holds only node IDs, never pointers, so it means the same wherever each
+process maps it.
+
+    inserts      join() claims an empty slot by swapping its ID from
+                 UNUSED to SHARED_BUSY, fills in the node, then publishes
+                 the real ID. A lookup that meets a busy slot waits for
+                 it, so no node is ever interned twice.
+    cache        each group of slots has a sequence number (a seqlock):
+                 a writer makes it odd while it writes, and a reader
+                 that sees it change treats the entry as a miss. A
+                 writer that finds the group busy skips caching; an
+                 entry is only ever a hint.
+    size         the index is never resized, since every process would
+                 have to remap it at once. Pick the size up front. Once
+                 a table is more than half full, advance_poll() returns
+                 ADVANCE_FULL after each step, so the caller can vacuum.
+                 Past 7/8 full, join() returns UNUSED rather than add a
+                 node, and so do set_cells(), advance() and the rest.
+    rule         set when the table is created, and fixed; set_rule()
+                 to any other rule fails.
+    vacuum       shared_vacuum() (or vacuum_roots()) is collective: it
+                 returns once every attached process has called it. Each
+                 marks its own roots, then the last compacts the index
+                 in place. Other processes may not attach meanwhile.
+
+A process that dies while attached will hold up the next vacuum.
+*/
+
+#define SHARED_MAGIC 0x484c534841524544ULL // set last, once the creator has initialised the table
+#define SHARED_BUSY (1ULL << 63)           // slot claimed, node being written
+#define SHARED_STRIPES 4096                // cache seqlocks (slot index mod SHARED_STRIPES)
+#define SHARED_MAX_LOAD 2                  // full when more than 1/SHARED_MAX_LOAD of the slots are used
+#define SHARED_HARD_LOAD 8                 // join() fails when fewer than 1/SHARED_HARD_LOAD of the slots are free
+
+typedef struct shared_header
+{
+    uint64_t magic;
+    uint64_t size;  // slots in the index
+    uint64_t count; // nodes interned (updated atomically)
+    char rule[RULE_NAME_LEN];
+    pthread_mutex_t lock; // guards the fields below
+    pthread_cond_t changed;
+    uint64_t attached;   // processes with the table open
+    uint64_t arrived;    // processes waiting in shared_vacuum()
+    uint64_t marked;     // ... of which have marked their roots
+    uint64_t vacuum_gen; // vacuums completed
+    uint64_t seq[SHARED_STRIPES];
+} shared_header;
+
+node_table *open_shared_table(const char *name, uint64_t size, const char *rule);
+void close_shared_table(node_table *table);
+int unlink_shared_table(const char *name);
+void shared_vacuum(node_table *table, const node_id *roots, uint64_t n_roots);
+void shared_wait(void);
+
+#endif // SHARED_H
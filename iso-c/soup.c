@@ -0,0 +1,648 @@
+/*
+    Random soup search and object census; see soup.h.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "soup.h"
+#include "period.h"
+#include "cell_io.h"
+#include <pthread.h>
+
+typedef struct cell_list
+{
+    int64_t *x, *y;
+    uint64_t n, max;
+} cell_list;
+
+static void add_cell(cell_list *cells, int64_t x, int64_t y)
+{
+    if (cells->n == cells->max)
+    {
+        cells->max = cells->max ? cells->max * 2 : 256;
+        cells->x = realloc(cells->x, cells->max * sizeof(int64_t));
+        cells->y = realloc(cells->y, cells->max * sizeof(int64_t));
+    }
+    cells->x[cells->n] = x;
+    cells->y[cells->n++] = y;
+}
+
+/* Append the live cells of id, offset by (x,y) */
+static void collect_cells(node_table *table, node_id id, int64_t x, int64_t y, cell_list *cells)
+{
+    cell_iter it;
+    int64_t xy[512];
+    uint64_t n;
+    cell_iter_init(table, &it, id, x, y);
+    while ((n = cell_iter_next(&it, xy, 256)) > 0)
+        for (uint64_t i = 0; i < n; i++)
+            add_cell(cells, xy[2 * i], xy[2 * i + 1]);
+}
+
+/* Soup index of a search with the given seed, as a size x size node */
+node_id random_soup(node_table *table, uint64_t seed, uint64_t index, uint64_t size)
+{
+    uint64_t state = mix64(seed ^ mix64(index + 1));
+    char *text = malloc(size * (size + 1) + 1), *p = text;
+    for (uint64_t y = 0; y < size; y++)
+    {
+        for (uint64_t x = 0; x < size; x += 64)
+        {
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t bits = mix64(state);
+            for (uint64_t i = x; i < size && i < x + 64; i++, bits >>= 1)
+                *p++ = (bits & 1) ? 'O' : '.';
+        }
+        *p++ = '\n';
+    }
+    *p = 0;
+    node_id id = from_text(table, text);
+    free(text);
+    return id;
+}
+
+/* Plain text of a set of cells under one of the eight symmetries of the square
+    (bit 0: flip x, bit 1: flip y, bit 2: swap x and y), at the origin. Caller frees. */
+static char *oriented_text(const cell_list *cells, int transform)
+{
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+    for (uint64_t i = 0; i < cells->n; i++)
+    {
+        x0 = min(x0, cells->x[i]), y0 = min(y0, cells->y[i]);
+        x1 = cells->x[i] > x1 ? cells->x[i] : x1, y1 = cells->y[i] > y1 ? cells->y[i] : y1;
+    }
+    int64_t w = x1 - x0 + 1, h = y1 - y0 + 1;
+    if (transform & 4)
+    {
+        int64_t t = w;
+        w = h, h = t;
+    }
+    char *text = malloc((w + 1) * h + 1);
+    for (int64_t y = 0; y < h; y++)
+    {
+        memset(text + y * (w + 1), '.', w);
+        text[y * (w + 1) + w] = '\n';
+    }
+    text[(w + 1) * h] = 0;
+    for (uint64_t i = 0; i < cells->n; i++)
+    {
+        int64_t x = cells->x[i] - x0, y = cells->y[i] - y0;
+        if (transform & 4)
+        {
+            int64_t t = x;
+            x = y, y = t;
+        }
+        if (transform & 1)
+            x = w - 1 - x;
+        if (transform & 2)
+            y = h - 1 - y;
+        text[y * (w + 1) + x] = 'O';
+    }
+    return text;
+}
+
+/* Compact RLE (no header) of a plain text pattern. Caller frees. */
+static char *text_to_rle(const char *text)
+{
+    char *rle = malloc(4 * strlen(text) + 2), *p = rle;
+    int blank_rows = 0;
+    for (const char *row = text; *row;)
+    {
+        const char *end = strchr(row, '\n');
+        if (!end)
+            end = row + strlen(row);
+        const char *last = end;
+        while (last > row && last[-1] != 'O')
+            last--;
+        if (last == row)
+            blank_rows++;
+        else
+        {
+            if (p != rle) // end the last row, and any blank rows since
+                p += blank_rows ? sprintf(p, "%d$", blank_rows + 1) : sprintf(p, "$");
+            blank_rows = 0;
+            for (const char *c = row; c < last;)
+            {
+                const char *run = c;
+                while (run < last && *run == *c)
+                    run++;
+                if (run - c > 1)
+                    p += sprintf(p, "%d", (int)(run - c));
+                *p++ = *c == 'O' ? 'o' : 'b';
+                c = run;
+            }
+        }
+        row = *end ? end + 1 : end;
+    }
+    strcpy(p, "!");
+    return rle;
+}
+
+void census_init(census *c)
+{
+    c->size = 64;
+    c->n = 0;
+    c->entries = calloc(c->size, sizeof(census_entry));
+    c->soups = c->unstable = 0;
+}
+
+void census_free(census *c)
+{
+    for (uint64_t i = 0; i < c->size; i++)
+        free(c->entries[i].rle);
+    free(c->entries);
+    c->entries = NULL;
+    c->size = c->n = 0;
+}
+
+/* Find the entry for key, adding an empty one if needed */
+census_entry *census_find(census *c, uint64_t key)
+{
+    if (2 * (c->n + 1) > c->size)
+    {
+        census old = *c;
+        c->size *= 2;
+        c->n = 0;
+        c->entries = calloc(c->size, sizeof(census_entry));
+        for (uint64_t i = 0; i < old.size; i++)
+            if (old.entries[i].key)
+                *census_find(c, old.entries[i].key) = old.entries[i];
+        free(old.entries);
+    }
+    uint64_t i = key & (c->size - 1);
+    while (c->entries[i].key && c->entries[i].key != key)
+        i = (i + 1) & (c->size - 1);
+    if (!c->entries[i].key)
+    {
+        c->entries[i].key = key;
+        c->n++;
+    }
+    return &c->entries[i];
+}
+
+/* Add every entry of from into to, taking ownership of the names */
+static void census_merge(census *to, census *from)
+{
+    for (uint64_t i = 0; i < from->size; i++)
+    {
+        census_entry *e = &from->entries[i];
+        if (!e->key)
+            continue;
+        census_entry *t = census_find(to, e->key);
+        if (!t->count)
+        {
+            *t = *e;
+            e->rle = NULL;
+        }
+        else
+            t->count += e->count;
+    }
+    to->soups += from->soups;
+    to->unstable += from->unstable;
+}
+
+/* Objects already classified by a worker, by the hash_life_text() of the
+    object as found (in whatever orientation and phase). The same object
+    turns up in soup after soup, so most need no period search at all. */
+typedef struct known_object
+{
+    uint64_t found;    // hash as found (0 for an empty slot)
+    census_entry name; // its census entry (count unused); owns the RLE
+} known_object;
+
+typedef struct object_memo
+{
+    known_object *slots; // open-addressed on found, never more than half full
+    uint64_t size, n;
+} object_memo;
+
+static void memo_init(object_memo *memo)
+{
+    memo->size = SOUP_MEMO_OBJECTS * 2;
+    memo->n = 0;
+    memo->slots = calloc(memo->size, sizeof(known_object));
+}
+
+static void memo_free(object_memo *memo)
+{
+    for (uint64_t i = 0; i < memo->size; i++)
+        free(memo->slots[i].name.rle);
+    free(memo->slots);
+}
+
+/* The slot for found: either holding it, or empty */
+static known_object *memo_slot(object_memo *memo, uint64_t found)
+{
+    uint64_t i = found & (memo->size - 1);
+    while (memo->slots[i].found && memo->slots[i].found != found)
+        i = (i + 1) & (memo->size - 1);
+    return &memo->slots[i];
+}
+
+/* Count one more of a known object in the census */
+static void census_add(census *c, const census_entry *name)
+{
+    census_entry *e = census_find(c, name->key);
+    if (!e->count++)
+    {
+        uint64_t count = e->count;
+        *e = *name;
+        e->count = count;
+        e->rle = strdup(name->rle);
+    }
+}
+
+/* Canonicalise one object (as plain text) into the census; false if it is not yet periodic */
+static bool classify(node_table *table, char *text, object_memo *memo, census *c)
+{
+    uint64_t found = hash_life_text(text);
+    found = found ? found : 1;
+    known_object *known = memo_slot(memo, found);
+    if (known->found)
+    {
+        census_add(c, &known->name);
+        return true;
+    }
+    node_id id = from_text(table, text);
+    period_info info;
+    if (!find_period(table, id, SOUP_MAX_PERIOD, &info) || info.first != 0)
+        return false;
+    uint64_t best = UINT64_MAX, pop = 0;
+    char *best_text = NULL;
+    for (uint64_t phase = 0; phase < info.period; phase++)
+    {
+        cell_list cells = {0};
+        collect_cells(table, id, 0, 0, &cells);
+        for (int t = 0; t < 8; t++)
+        {
+            char *text = oriented_text(&cells, t);
+            uint64_t h = hash_life_text(text);
+            if (h < best || !best_text)
+            {
+                best = h, pop = cells.n;
+                free(best_text);
+                best_text = text;
+            }
+            else
+                free(text);
+        }
+        free(cells.x);
+        free(cells.y);
+        id = advance(table, id, 1);
+    }
+    census_entry name = {.key = best ? best : 1, .pop = pop, .period = info.period};
+    // displacement as unsigned, larger first, so that every orientation agrees
+    name.dx = llabs(info.dx), name.dy = llabs(info.dy);
+    if (name.dx < name.dy)
+    {
+        int64_t t = name.dx;
+        name.dx = name.dy, name.dy = t;
+    }
+    name.rle = text_to_rle(best_text);
+    free(best_text);
+    census_add(c, &name);
+    if (memo->n < SOUP_MEMO_OBJECTS)
+    {
+        known->found = found;
+        known->name = name;
+        memo->n++;
+    }
+    else
+        free(name.rle);
+    return true;
+}
+
+/* A cell and its index in a cell_list, ordered by (y,x) */
+typedef struct sorted_cell
+{
+    int64_t y, x;
+    uint64_t i;
+} sorted_cell;
+
+static int cmp_cells(const void *a, const void *b)
+{
+    const sorted_cell *p = a, *q = b;
+    if (p->y != q->y)
+        return p->y < q->y ? -1 : 1;
+    return (p->x > q->x) - (p->x < q->x);
+}
+
+/* A cell's place in the ash: its cluster, then its part of the cluster */
+typedef struct grouped_cell
+{
+    uint64_t cluster, part, i;
+} grouped_cell;
+
+static int cmp_groups(const void *a, const void *b)
+{
+    const grouped_cell *p = a, *q = b;
+    if (p->cluster != q->cluster)
+        return p->cluster < q->cluster ? -1 : 1;
+    if (p->part != q->part)
+        return p->part < q->part ? -1 : 1;
+    return (p->i > q->i) - (p->i < q->i);
+}
+
+static uint64_t find_root(uint64_t *parent, uint64_t k)
+{
+    while (parent[k] != k)
+        k = parent[k] = parent[parent[k]];
+    return k;
+}
+
+static void unite(uint64_t *parent, uint64_t a, uint64_t b)
+{
+    parent[find_root(parent, a)] = find_root(parent, b);
+}
+
+/* Order-free signature of the live cells of id: their number, and the sum of their hashes */
+static void cell_signature(node_table *table, node_id id, uint64_t *pop, uint64_t *sum)
+{
+    cell_iter it;
+    int64_t xy[512];
+    uint64_t n;
+    cell_iter_init(table, &it, id, 0, 0);
+    while ((n = cell_iter_next(&it, xy, 256)) > 0)
+        for (uint64_t i = 0; i < n; i++)
+        {
+            *pop += 1;
+            *sum += mix64((uint64_t)xy[2 * i] ^ mix64((uint64_t)xy[2 * i + 1]));
+        }
+}
+
+/* Whether a cluster of parts (cells[part_start[k]..part_start[k+1]) for each
+    part k) is a pseudo-object: over the cluster's whole period, it is always
+    just its parts, each run on its own. Parts that ever interact (as the
+    quarters of a pulsar do) make one object. */
+static bool separable(node_table *table, const cell_list *cells, const uint64_t *part_start, uint64_t parts)
+{
+    // a common frame, with room for anything within the period to move in
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+    for (uint64_t i = 0; i < cells->n; i++)
+    {
+        x0 = min(x0, cells->x[i]), y0 = min(y0, cells->y[i]);
+        x1 = cells->x[i] > x1 ? cells->x[i] : x1, y1 = cells->y[i] > y1 ? cells->y[i] : y1;
+    }
+    int64_t margin = SOUP_MAX_PERIOD / 2 + 1, extent = (x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0) + 1 + 2 * margin;
+    uint64_t level = 3;
+    while ((1LL << level) < extent)
+        level++;
+    node_id *ids = malloc((parts + 1) * sizeof(node_id));
+    uint64_t *xy = malloc(2 * (cells->n + 1) * sizeof(uint64_t));
+    for (uint64_t i = 0; i < cells->n; i++)
+        xy[2 * i] = cells->x[i] - x0 + margin, xy[2 * i + 1] = cells->y[i] - y0 + margin;
+    ids[parts] = set_cells(table, get_zero(table, level), xy, cells->n);
+    for (uint64_t k = 0; k < parts; k++)
+        ids[k] = set_cells(table, get_zero(table, level), xy + 2 * part_start[k], part_start[k + 1] - part_start[k]);
+    free(xy);
+    period_info info;
+    bool split = find_period(table, ids[parts], SOUP_MAX_PERIOD, &info) && info.first == 0;
+    for (uint64_t t = 1; split && t <= info.period; t++)
+    {
+        uint64_t size = 1ULL << level, pop = 0, sum = 0, part_pop = 0, part_sum = 0;
+        cell_signature(table, advance_region(table, ids[parts], t, 0, 0, size, size), &pop, &sum);
+        for (uint64_t k = 0; k < parts; k++)
+            cell_signature(table, advance_region(table, ids[k], t, 0, 0, size, size), &part_pop, &part_sum);
+        split = pop == part_pop && sum == part_sum;
+    }
+    free(ids);
+    return split;
+}
+
+/* Classify one object, given by some of the cells of the ash */
+static bool classify_cells(node_table *table, const cell_list *cells, const uint64_t *which, uint64_t n, object_memo *memo, census *c)
+{
+    cell_list object = {0};
+    for (uint64_t g = 0; g < n; g++)
+        add_cell(&object, cells->x[which[g]], cells->y[which[g]]);
+    char *text = oriented_text(&object, 0);
+    bool stable = classify(table, text, memo, c);
+    free(text);
+    free(object.x);
+    free(object.y);
+    return stable;
+}
+
+/* Split the ash into objects and classify each; false if any is not yet periodic.
+    Cells within SOUP_OBJECT_GAP of each other form a cluster, and touching
+    cells form a part of one; a cluster whose parts are separable() is
+    counted as its parts. */
+static bool census_ash(node_table *table, node_id id, object_memo *memo, census *c)
+{
+    cell_list cells = {0};
+    collect_cells(table, id, 0, 0, &cells);
+    uint64_t n = cells.n;
+    uint64_t *cluster = malloc((n + 1) * sizeof(uint64_t)), *part = malloc((n + 1) * sizeof(uint64_t));
+    // cells come out in quadtree order; sort by (y,x) so neighbours can be found by bisection
+    sorted_cell *order = malloc((n + 1) * sizeof(sorted_cell));
+    for (uint64_t i = 0; i < n; i++)
+    {
+        cluster[i] = part[i] = i;
+        order[i] = (sorted_cell){cells.y[i], cells.x[i], i};
+    }
+    qsort(order, n, sizeof(sorted_cell), cmp_cells);
+    for (uint64_t i = 0; i < n; i++)
+        for (int64_t dy = 0; dy <= SOUP_OBJECT_GAP; dy++)
+            for (int64_t dx = -SOUP_OBJECT_GAP; dx <= SOUP_OBJECT_GAP; dx++)
+            {
+                if (dy == 0 && dx <= 0)
+                    continue;
+                // bisect for (x+dx, y+dy)
+                sorted_cell want = {order[i].y + dy, order[i].x + dx, 0};
+                uint64_t lo = i + 1, hi = n;
+                while (lo < hi)
+                {
+                    uint64_t mid = (lo + hi) / 2;
+                    if (cmp_cells(&order[mid], &want) < 0)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                if (lo < n && !cmp_cells(&order[lo], &want))
+                {
+                    unite(cluster, order[i].i, order[lo].i);
+                    if (dy <= 1 && dx >= -1 && dx <= 1)
+                        unite(part, order[i].i, order[lo].i);
+                }
+            }
+    // group the cells by cluster, and within each by part
+    grouped_cell *groups = malloc((n + 1) * sizeof(grouped_cell));
+    for (uint64_t i = 0; i < n; i++)
+        groups[i] = (grouped_cell){find_root(cluster, i), find_root(part, i), i};
+    qsort(groups, n, sizeof(grouped_cell), cmp_groups);
+    uint64_t *which = malloc((n + 1) * sizeof(uint64_t)), *part_start = malloc((n + 2) * sizeof(uint64_t));
+    for (uint64_t i = 0; i < n; i++)
+        which[i] = groups[i].i;
+    bool stable = true;
+    for (uint64_t first = 0, end; first < n && stable; first = end)
+    {
+        uint64_t parts = 0;
+        for (end = first; end < n && groups[end].cluster == groups[first].cluster; end++)
+            if (end == first || groups[end].part != groups[end - 1].part)
+                part_start[parts++] = end - first;
+        part_start[parts] = end - first;
+        bool split = false;
+        if (parts > 1)
+        {
+            cell_list cluster_cells = {0};
+            for (uint64_t g = first; g < end; g++)
+                add_cell(&cluster_cells, cells.x[which[g]], cells.y[which[g]]);
+            split = separable(table, &cluster_cells, part_start, parts);
+            free(cluster_cells.x);
+            free(cluster_cells.y);
+        }
+        if (split)
+        {
+            // each part must be an object too: a spaceship's stray cell can die without effect
+            census parts_found;
+            census_init(&parts_found);
+            for (uint64_t k = 0; k < parts && split; k++)
+                split = classify_cells(table, &cells, which + first + part_start[k], part_start[k + 1] - part_start[k], memo, &parts_found);
+            if (split)
+                census_merge(c, &parts_found);
+            census_free(&parts_found);
+        }
+        if (!split)
+            stable = classify_cells(table, &cells, which + first, end - first, memo, c);
+    }
+    free(part_start);
+    free(which);
+    free(groups);
+    free(order);
+    free(part);
+    free(cluster);
+    free(cells.x);
+    free(cells.y);
+    return stable;
+}
+
+/* Tally the objects of a stable pattern into c; false (with c unchanged) if any is not periodic */
+bool census_pattern(node_table *table, node_id id, census *c)
+{
+    object_memo memo;
+    census objects;
+    memo_init(&memo);
+    census_init(&objects);
+    bool stable = census_ash(table, id, &memo, &objects);
+    if (stable)
+        census_merge(c, &objects);
+    census_free(&objects);
+    memo_free(&memo);
+    return stable;
+}
+
+/* Run one soup to stability, and add its objects to the census */
+static void run_soup(node_table *table, const soup_params *params, uint64_t index, object_memo *memo, census *c)
+{
+    node_id id = random_soup(table, params->seed, index, params->soup_size);
+    c->soups++;
+    for (uint64_t gen = 0; gen < params->max_generations; gen += SOUP_STEP)
+    {
+        id = advance(table, id, SOUP_STEP);
+        uint64_t pop = lookup(table, id)->pop;
+        if (lookup(table, advance(table, id, SOUP_CHECK_GAP))->pop != pop)
+            continue;
+        census objects;
+        census_init(&objects);
+        bool stable = census_ash(table, id, memo, &objects);
+        if (stable)
+            census_merge(c, &objects);
+        census_free(&objects);
+        if (stable)
+            return;
+    }
+    c->unstable++;
+}
+
+typedef struct worker
+{
+    const soup_params *params;
+    int index;
+    census result;
+} worker;
+
+static void *soup_worker(void *arg)
+{
+    worker *w = arg;
+    node_table *table = create_table(1 << 16);
+    object_memo memo;
+    memo_init(&memo);
+    census_init(&w->result);
+    for (uint64_t i = w->index; i < w->params->n_soups; i += w->params->threads)
+    {
+        run_soup(table, w->params, i, &memo, &w->result);
+        // each soup's history is its own: beyond the leaves, little of it
+        // recurs in later soups, and a small table is faster to work in
+        if (table->count > SOUP_VACUUM_NODES)
+            vacuum_roots(table, NULL, 0);
+    }
+    memo_free(&memo);
+    free_table(table);
+    return NULL;
+}
+
+void soup_params_default(soup_params *params)
+{
+    params->seed = 0;
+    params->n_soups = 1000;
+    params->soup_size = 16;
+    params->max_generations = 1 << 16;
+    params->threads = 1;
+}
+
+/* Search params->n_soups soups across params->threads threads into out */
+void soup_search(const soup_params *params, census *out)
+{
+    int threads = params->threads > 0 ? params->threads : 1;
+    soup_params p = *params;
+    p.threads = threads;
+    worker *workers = calloc(threads, sizeof(worker));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    bool *started = calloc(threads, sizeof(bool));
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].params = &p;
+        workers[t].index = t;
+        started[t] = pthread_create(&ids[t], NULL, soup_worker, &workers[t]) == 0;
+    }
+    // a worker whose thread would not start runs here instead, so no soup is missed
+    for (int t = 0; t < threads; t++)
+        if (!started[t])
+            soup_worker(&workers[t]);
+    census_init(out);
+    for (int t = 0; t < threads; t++)
+    {
+        if (started[t])
+            pthread_join(ids[t], NULL);
+        census_merge(out, &workers[t].result);
+        census_free(&workers[t].result);
+    }
+    free(workers);
+    free(ids);
+    free(started);
+}
+
+static int cmp_entries(const void *a, const void *b)
+{
+    const census_entry *x = *(census_entry *const *)a, *y = *(census_entry *const *)b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/* Print the census, most common objects first */
+void census_print(census *c, FILE *out)
+{
+    census_entry **sorted = malloc((c->n + 1) * sizeof(census_entry *));
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < c->size; i++)
+        if (c->entries[i].key)
+            sorted[n++] = &c->entries[i];
+    qsort(sorted, n, sizeof(census_entry *), cmp_entries);
+    fprintf(out, "# %llu soups, %llu unstable, %llu kinds of object\n", (unsigned long long)c->soups,
+            (unsigned long long)c->unstable, (unsigned long long)n);
+    fprintf(out, "# count pop period dx dy rle\n");
+    for (uint64_t i = 0; i < n; i++)
+        fprintf(out, "%llu %llu %llu %lld %lld %s\n", (unsigned long long)sorted[i]->count,
+                (unsigned long long)sorted[i]->pop, (unsigned long long)sorted[i]->period,
+                (long long)sorted[i]->dx, (long long)sorted[i]->dy, sorted[i]->rle);
+    free(sorted);
+}
@@ -0,0 +1,74 @@
+#ifndef SOUP_H
+#define SOUP_H
+#include "hashlife.h"
+
+/* Random soup search and object census
+
+Generates seeded random soups, runs each until its ash is stable, splits
+the ash into objects, and tallies each object under a canonical name that
+is the same for every rotation, reflection and phase.
+
+- Soup i of a search is filled from mix64(seed, i) alone, so a run is
+  reproduced exactly by the same seed, whatever the thread count.
+- Soups are spread over worker threads. Tables are not thread-safe, so
+  each worker has a table of its own, kept across its soups and vacuumed
+  back to the leaves when it grows past SOUP_VACUUM_NODES. Each soup's
+  history is its own, so little more than the leaves would be reused,
+  and a small table is faster to work in.
+- A soup is stable when every object found in it is periodic (see
+  period.h) with period at most SOUP_MAX_PERIOD, and the population is
+  unchanged SOUP_CHECK_GAP generations later. Soups not stable by
+  max_generations are counted as unstable and not tallied.
+- Objects are groups of cells within SOUP_OBJECT_GAP of each other
+  (Chebyshev distance), split into their touching parts when those never
+  interact over the group's period (so a pair of blocks one row apart is
+  two blocks, but a pulsar is one pulsar). Each is canonicalised by taking
+  the smallest hash_life_text() over its eight orientations and all its
+  phases. Each worker remembers the name of every object it has seen, so
+  a common object is only simulated once per worker.
+*/
+
+#define SOUP_STEP 1024                       // generations between stability checks
+#define SOUP_CHECK_GAP 240                   // multiple of every common period
+#define SOUP_MAX_PERIOD 240                  // longest period searched for per object
+#define SOUP_OBJECT_GAP 2                    // cells this close belong to the same object
+#define SOUP_VACUUM_NODES (1ULL << 18)       // worker tables are vacuumed past this size
+#define SOUP_MEMO_OBJECTS (1ULL << 16)       // objects each worker remembers the census entry of
+
+typedef struct soup_params
+{
+    uint64_t seed;
+    uint64_t n_soups;
+    uint64_t soup_size;       // soups are soup_size x soup_size, 50% density
+    uint64_t max_generations; // give up on a soup after this many generations
+    int threads;
+} soup_params;
+
+/* One kind of object, under its canonical name */
+typedef struct census_entry
+{
+    uint64_t key;    // canonical hash
+    uint64_t count;  // times seen
+    uint64_t pop;    // population (in the canonical phase)
+    uint64_t period; // generations per cycle
+    int64_t dx, dy;  // displacement per cycle (non-zero for spaceships)
+    char *rle;       // canonical orientation and phase, as RLE
+} census_entry;
+
+typedef struct census
+{
+    census_entry *entries; // open-addressed on key
+    uint64_t size, n;
+    uint64_t soups, unstable;
+} census;
+
+void soup_params_default(soup_params *params);
+node_id random_soup(node_table *table, uint64_t seed, uint64_t index, uint64_t size);
+void soup_search(const soup_params *params, census *out);
+void census_init(census *c);
+void census_free(census *c);
+census_entry *census_find(census *c, uint64_t key);
+void census_print(census *c, FILE *out);
+bool census_pattern(node_table *table, node_id id, census *c);
+
+#endif // SOUP_H
@@ -0,0 +1,77 @@
+#include "hashlife.h"
+
+void reset_stats(node_table *table)
+{
+    memset(&table->stats, 0, sizeof(table->stats));
+}
+
+void count_levels(node_table *table, uint64_t counts[STATS_LEVELS])
+{
+    memset(counts, 0, STATS_LEVELS * sizeof(uint64_t));
+    for (uint64_t i = 0; i < table->size; i++)
+    {
+        node_id id = table->index[i].id;
+        if (id != UNUSED)
+            counts[STATS_BUCKET(LEVEL(id))]++;
+    }
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+    return total ? (100.0 * part) / total : 0.0;
+}
+
+static void print_successor_row(FILE *out, const char *key, int i, uint64_t hits, uint64_t misses, uint64_t overwrites,
+                                uint64_t kept)
+{
+    if (hits + misses + overwrites + kept == 0)
+        return;
+    fprintf(out, "  %s %2d%s  hits %12llu  misses %12llu  hit rate %6.2f%%  overwrites %12llu  kept %12llu\n",
+            key, i, i == STATS_LEVELS - 1 ? "+" : " ", (unsigned long long)hits, (unsigned long long)misses,
+            percent(hits, hits + misses), (unsigned long long)overwrites, (unsigned long long)kept);
+}
+
+void print_stats(node_table *table, FILE *out)
+{
+    table_stats *s = &table->stats;
+    uint64_t levels[STATS_LEVELS];
+    uint64_t probes = 0;
+
+#if !HL_STATS
+    fprintf(out, "(statistics compiled out; build with HL_STATS=1 for counters)\n");
+#endif
+    fprintf(out, "Table: %llu nodes in %llu slots (load %.2f%%)\n", (unsigned long long)table->count,
+            (unsigned long long)table->size, percent(table->count, table->size));
+    fprintf(out, "Join: hits %llu  misses %llu  hit rate %.2f%%  doppelganger rehashes %llu\n",
+            (unsigned long long)s->join_hits, (unsigned long long)s->join_misses,
+            percent(s->join_hits, s->join_hits + s->join_misses), (unsigned long long)s->doppelgangers);
+
+    for (int i = 0; i < STATS_PROBES; i++)
+        probes += s->probe_hist[i];
+    fprintf(out, "Probe lengths:");
+    for (int i = 0; i < STATS_PROBES; i++)
+        if (s->probe_hist[i])
+            fprintf(out, " %d%s:%.2f%%", i, i == STATS_PROBES - 1 ? "+" : "", percent(s->probe_hist[i], probes));
+    fprintf(out, "\n");
+
+    fprintf(out, "Successor cache by level:\n");
+    for (int i = 0; i < STATS_LEVELS; i++)
+        print_successor_row(out, "level", i, s->succ_hits[i], s->succ_misses[i], s->succ_overwrites[i],
+                            s->succ_kept[i]);
+    fprintf(out, "Successor cache by j:\n");
+    for (int i = 0; i < STATS_LEVELS; i++)
+        print_successor_row(out, "j", i, s->succ_hits_j[i], s->succ_misses_j[i], s->succ_overwrites_j[i],
+                            s->succ_kept_j[i]);
+
+    fprintf(out, "Resize: %llu times, %.3f ms\n", (unsigned long long)s->resizes, s->resize_ns / 1e6);
+    fprintf(out, "Vacuum: %llu times, %.3f ms, %llu survivors last time, %llu nodes freed\n",
+            (unsigned long long)s->vacuums, s->vacuum_ns / 1e6,
+            (unsigned long long)s->vacuum_survivors, (unsigned long long)s->vacuum_freed);
+
+    count_levels(table, levels);
+    fprintf(out, "Nodes by level:");
+    for (int i = 0; i < STATS_LEVELS; i++)
+        if (levels[i])
+            fprintf(out, " %d%s:%llu", i, i == STATS_LEVELS - 1 ? "+" : "", (unsigned long long)levels[i]);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,57 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdint.h>
+#include <stdio.h>
+
+/* Engine statistics
+
+Cheap counters kept on every node_table, to show why a run is slow:
+how well join() and the successor cache hit, how long probes are,
+and how much time goes into resizing and garbage collection.
+
+Build with -DHL_STATS=0 to compile all counting out; the struct
+stays, so code using it still builds, but every counter reads zero.
+
+Per-level and per-j counters are clamped into STATS_LEVELS buckets;
+probe lengths of STATS_PROBES or more share the last bucket.
+*/
+
+#ifndef HL_STATS
+#define HL_STATS 1
+#endif
+
+#if HL_STATS
+#define STAT(x) (x)
+#else
+#define STAT(x) ((void)0)
+#endif
+
+#define STATS_LEVELS 64
+#define STATS_PROBES 16
+#define STATS_BUCKET(x) ((x) < STATS_LEVELS ? (x) : STATS_LEVELS - 1)
+
+typedef struct table_stats
+{
+    uint64_t join_hits, join_misses;
+    uint64_t doppelgangers; // rehashes in join() after an ID collision
+    uint64_t probe_hist[STATS_PROBES];
+
+    // successor cache, by level of the node and by j
+    uint64_t succ_hits[STATS_LEVELS], succ_misses[STATS_LEVELS], succ_overwrites[STATS_LEVELS];
+    uint64_t succ_hits_j[STATS_LEVELS], succ_misses_j[STATS_LEVELS], succ_overwrites_j[STATS_LEVELS];
+    uint64_t succ_kept[STATS_LEVELS], succ_kept_j[STATS_LEVELS]; // survived a contest for their bucket
+
+    uint64_t resizes, resize_ns;
+    uint64_t vacuums, vacuum_ns;
+    uint64_t vacuum_survivors; // nodes kept by the last vacuum
+    uint64_t vacuum_freed;     // nodes removed by all vacuums
+} table_stats;
+
+struct node_table;
+
+void reset_stats(struct node_table *table);
+/* Count live nodes at each level (clamped into STATS_LEVELS buckets) */
+void count_levels(struct node_table *table, uint64_t counts[STATS_LEVELS]);
+void print_stats(struct node_table *table, FILE *out);
+
+#endif // STATS_H
@@ -0,0 +1,207 @@
+/*
+    Page-size and NUMA aware allocation for the node table.
+    See table_alloc.h for the policy flags.
+*/
+#define _GNU_SOURCE
+#include "table_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MPOL_INTERLEAVE 3
+#define MAX_NUMA_WORDS 4
+
+/* The default huge page size from /proc/meminfo (0 if unknown), read once */
+static uint64_t hugetlb_page_size(void)
+{
+    static uint64_t cached = UINT64_MAX; // not read yet
+    uint64_t size = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (size != UINT64_MAX)
+        return size;
+    FILE *f = fopen("/proc/meminfo", "r");
+    char line[256];
+    unsigned long long kb = 0;
+    if (f)
+    {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "Hugepagesize: %llu kB", &kb) == 1)
+                break;
+        fclose(f);
+    }
+    size = (uint64_t)kb * 1024;
+    __atomic_store_n(&cached, size, __ATOMIC_RELAXED); // threads racing here all store the same value
+    return size;
+}
+
+/* Parse the online node list (e.g. "0-1,3") into a mask, returning the number of nodes */
+static int online_numa_nodes(unsigned long *mask)
+{
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    int nodes = 0;
+    unsigned lo, hi;
+    char sep;
+    memset(mask, 0, MAX_NUMA_WORDS * sizeof(unsigned long));
+    if (!f)
+        return 0;
+    while (fscanf(f, "%u", &lo) == 1)
+    {
+        hi = lo;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-')
+        {
+            if (fscanf(f, "%u", &hi) != 1)
+                break;
+            if (fscanf(f, "%c", &sep) != 1)
+                sep = 0;
+        }
+        for (unsigned n = lo; n <= hi && n < MAX_NUMA_WORDS * 8 * sizeof(unsigned long); n++)
+        {
+            mask[n / (8 * sizeof(unsigned long))] |= 1UL << (n % (8 * sizeof(unsigned long)));
+            nodes++;
+        }
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return nodes;
+}
+
+/* Set an interleave policy on a fresh (untouched) mapping */
+static bool interleave(void *ptr, uint64_t bytes)
+{
+    unsigned long mask[MAX_NUMA_WORDS];
+    if (online_numa_nodes(mask) < 2)
+        return false;
+    return syscall(SYS_mbind, ptr, bytes, MPOL_INTERLEAVE, mask, MAX_NUMA_WORDS * 8 * sizeof(unsigned long), 0) == 0;
+}
+
+/* Map anonymous memory aligned to `align`, trimming the slack */
+static void *map_aligned(uint64_t bytes, uint64_t align)
+{
+    uint64_t padded = bytes + align;
+    char *p = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    char *start = (char *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    if (start > p)
+        munmap(p, start - p);
+    if (start + bytes < p + padded)
+        munmap(start + bytes, (p + padded) - (start + bytes));
+    return start;
+}
+
+void *table_mem_alloc(table_mem *mem, uint64_t bytes, uint32_t flags)
+{
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    memset(mem, 0, sizeof(*mem));
+
+    if (bytes >= ALLOC_MMAP_MIN)
+    {
+        uint64_t huge = hugetlb_page_size();
+        if ((flags & ALLOC_HUGETLB) && huge)
+        {
+            uint64_t rounded = (bytes + huge - 1) & ~(huge - 1);
+            void *p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+            {
+                *mem = (table_mem){.ptr = p, .bytes = rounded, .page_size = huge, .method = METHOD_HUGETLB};
+                if (flags & ALLOC_INTERLEAVE)
+                    mem->interleaved = interleave(p, rounded);
+                return p;
+            }
+        }
+        uint64_t align = (flags & ALLOC_THP) && huge ? huge : page;
+        uint64_t rounded = (bytes + page - 1) & ~(page - 1);
+        void *p = map_aligned(rounded, align);
+        if (p)
+        {
+            *mem = (table_mem){.ptr = p, .bytes = rounded, .page_size = page, .method = METHOD_MMAP};
+            if (flags & ALLOC_INTERLEAVE)
+                mem->interleaved = interleave(p, rounded);
+#ifdef MADV_HUGEPAGE
+            if ((flags & ALLOC_THP) && madvise(p, rounded, MADV_HUGEPAGE) == 0)
+                mem->method = METHOD_MMAP_THP;
+#endif
+            return p;
+        }
+    }
+    mem->ptr = calloc(1, bytes);
+    mem->bytes = bytes;
+    mem->page_size = page;
+    mem->method = METHOD_CALLOC;
+    return mem->ptr;
+}
+
+void table_mem_free(table_mem *mem)
+{
+    if (mem->method == METHOD_CALLOC)
+        free(mem->ptr);
+    else if (mem->ptr)
+        munmap(mem->ptr, mem->bytes);
+    mem->ptr = NULL;
+}
+
+uint64_t table_mem_huge_bytes(const table_mem *mem)
+{
+    if (mem->method == METHOD_HUGETLB)
+        return mem->bytes;
+    if (mem->method == METHOD_CALLOC)
+        return 0;
+    /* find our mapping in smaps and read its AnonHugePages line */
+    FILE *f = fopen("/proc/self/smaps", "r");
+    char line[512];
+    unsigned long long kb = 0;
+    bool ours = false;
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            ours = start == (uintptr_t)mem->ptr;
+        else if (ours && sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return (uint64_t)kb * 1024;
+}
+
+#else
+
+/* Portable fallback: no page size or NUMA control */
+void *table_mem_alloc(table_mem *mem, uint64_t bytes, uint32_t flags)
+{
+    (void)flags;
+    memset(mem, 0, sizeof(*mem));
+    mem->ptr = calloc(1, bytes);
+    mem->bytes = bytes;
+    mem->page_size = 4096;
+    mem->method = METHOD_CALLOC;
+    return mem->ptr;
+}
+
+void table_mem_free(table_mem *mem)
+{
+    free(mem->ptr);
+    mem->ptr = NULL;
+}
+
+uint64_t table_mem_huge_bytes(const table_mem *mem)
+{
+    (void)mem;
+    return 0;
+}
+
+#endif
+
+void table_mem_report(const table_mem *mem, FILE *out)
+{
+    static const char *names[] = {"calloc", "mmap", "mmap+THP", "hugetlb"};
+    uint64_t huge = table_mem_huge_bytes(mem);
+    fprintf(out, "Table memory: %.1f MiB via %s, %llu KiB pages, %.1f MiB on huge pages%s\n",
+            mem->bytes / 1048576.0, names[mem->method], (unsigned long long)(mem->page_size / 1024),
+            huge / 1048576.0, mem->interleaved ? ", NUMA interleaved" : "");
+}
@@ -0,0 +1,61 @@
+#ifndef TABLE_ALLOC_H
+#define TABLE_ALLOC_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Allocation policy for the node table index.
+
+Large tables are probed at random, so on 4K pages almost every probe is a
+TLB miss. Where the OS supports it, the index is mapped with huge pages:
+
+    ALLOC_HUGETLB     try explicit huge pages (MAP_HUGETLB) first;
+                      these need pages reserved in /proc/sys/vm/nr_hugepages
+    ALLOC_THP         otherwise mmap and advise transparent huge pages
+    ALLOC_INTERLEAVE  interleave pages over all online NUMA nodes,
+                      for tables shared by threads on several sockets
+
+ALLOC_ARENA is not an allocation policy but a layout: the table keeps
+its nodes densely, in an order it controls (see "Arena layout" in
+hashlife.h). It is kept, with the rest of the flags, by copies and forks.
+
+Each step falls back quietly to the next; the last resort is calloc().
+Small allocations (below ALLOC_MMAP_MIN) always use calloc().
+The policy actually obtained is recorded in a table_mem.
+*/
+
+#define ALLOC_HUGETLB (1u << 0)
+#define ALLOC_THP (1u << 1)
+#define ALLOC_INTERLEAVE (1u << 2)
+#define ALLOC_ARENA (1u << 3)
+#define ALLOC_DEFAULT ALLOC_THP
+
+#define ALLOC_MMAP_MIN (2ULL << 20)
+
+/* How a block was actually obtained */
+typedef enum alloc_method
+{
+    METHOD_CALLOC,
+    METHOD_MMAP,
+    METHOD_MMAP_THP,
+    METHOD_HUGETLB
+} alloc_method;
+
+typedef struct table_mem
+{
+    void *ptr;
+    uint64_t bytes;     // size of the mapping (rounded up to page_size)
+    uint64_t page_size; // page size requested from the OS
+    alloc_method method;
+    bool interleaved; // NUMA interleave policy was applied
+} table_mem;
+
+/* Allocate a zeroed block; returns mem->ptr, or NULL on failure */
+void *table_mem_alloc(table_mem *mem, uint64_t bytes, uint32_t flags);
+void table_mem_free(table_mem *mem);
+
+/* Bytes of the block currently backed by transparent huge pages */
+uint64_t table_mem_huge_bytes(const table_mem *mem);
+void table_mem_report(const table_mem *mem, FILE *out);
+
+#endif // TABLE_ALLOC_H
@@ -1,11 +1,21 @@
+#define _POSIX_C_SOURCE 200809L
 #include "hashlife.h"
 #include "cell_io.h"
+#include "trace.h"
+#include "serve.h"
+#include "period.h"
+#include "soup.h"
+#include "search.h"
+#include "shared.h"
 #include <stdbool.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // macro to print test in green, with a tick at the start
 
@@ -172,22 +182,45 @@ void verify_successor_cache(node_table *table)
     TEST_START("Validating successor cache");
     for (uint64_t i = 0; i < table->size; i++)
     {
-        node *n = &table->index[i];
+        node *n = &(table->cache ? table->cache : table->index)[i];
         assert((n->from==UNUSED) == (n->to==UNUSED));
-        if (n->to != UNUSED)
+        node_id from = UNMARK(n->from), to = UNMARK(n->to); // the top bits hold the entry's age
+        if (n->to != UNUSED && !(n->j & CACHE_TAG))
         {
-            node *from_n = lookup(table, n->from);
-            assert(from_n->id == n->from); // from node must exist
-            node *to_n = lookup(table, n->to);
-            assert(to_n->id == n->to); // to node must exist
-            node_id expected_to = successor(table, n->from, n->j);
-            assert(expected_to == n->to);
+            node *from_n = lookup(table, from);
+            assert(from_n->id == from); // from node must exist
+            node *to_n = lookup(table, to);
+            assert(to_n->id == to); // to node must exist
+            node_id expected_to = successor_exact(table, from, n->j);
+            assert(expected_to == to);
         }
     }
     TEST_OK("Successor cache validated");
 
 }
 
+void test_alloc()
+{
+    TEST_START("Testing huge page / NUMA table allocation");
+    uint32_t policies[] = {ALLOC_DEFAULT, ALLOC_HUGETLB | ALLOC_THP | ALLOC_INTERLEAVE, 0};
+    for (int i = 0; i < 3; i++)
+    {
+        // big enough for the mmap path, and forced through resize and vacuum
+        node_table *table = create_table_alloc(1 << 16, policies[i]);
+        assert(table->mem.ptr != NULL && table->mem.bytes >= table->size * sizeof(node));
+        node_id pattern = from_rle(table, "24bo11b$22bobo11b$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o14b$2o8b\no3bob2o4bobo11b$10bo5bo7bo11b$11bo3bo20b$12b2o!");
+        node_id future = advance(table, pattern, 256);
+        vacuum(table, future);
+        while (table->size < (1 << 18))
+            resize_table(table);
+        verify_hashtable(table);
+        verify_successor_cache(table);
+        table_mem_report(&table->mem, stdout);
+        free_table(table);
+    }
+    TEST_OK("Table allocation verified");
+}
+
 #define TEST_CELLS 256
 void test_set_get()
 {
@@ -387,75 +420,6 @@ void test_pattern()
     TEST_OK("Pattern import/export verified");
 }
 
-/* static for timing access */
-static node_table *timing_table;
-static node_id timing_pattern;
-
-int time_next()
-{
-    node_id pattern = timing_pattern;
-    node_table *test_table = copy_table(timing_table);
-    for (int i = 0; i < 128; i++)
-        pattern = successor(test_table, centre(test_table, centre(test_table, pattern)), 0);
-    uint64_t pop = lookup(test_table, pattern)->pop;
-    free_table(test_table);
-    return pop;
-}
-
-int time_advance_1()
-{
-    node_id pattern = timing_pattern;
-
-    node_table *test_table = copy_table(timing_table);
-    pattern = advance(test_table, pattern, 1);    
-    uint64_t pop = lookup(test_table, pattern)->pop;
-    free_table(test_table);
-    return pop;
-}
-
-int time_advance_64()
-{
-    node_id pattern = timing_pattern;
-
-    pattern = advance(timing_table, pattern, 64);
-    return lookup(timing_table, pattern)->pop;
-}
-
-int time_advance_256()
-{
-    node_id pattern = timing_pattern;
-
-    pattern = advance(timing_table, pattern, 256);
-    return lookup(timing_table, pattern)->pop;
-}
-
-int time_advance_65535()
-{
-    node_id pattern = timing_pattern;    
-    node_table *test_table = copy_table(timing_table);
-    pattern = advance(test_table, pattern, 65535);
-    // report the total number of entries where from is non-zero
-    uint64_t count = 0;
-    for (uint64_t i = 0; i < test_table->size; i++)
-    {
-        node *n = &test_table->index[i];
-        if (n->from != 0)
-            count++;
-    }
-    printf("Cache load factor: %f%%\n", (count * 100.0) / test_table->size);
-
-    uint64_t pop =  lookup(test_table, pattern)->pop;
-    free_table(test_table);
-    return pop;
-}
-
-int time_advance_65536()
-{
-    node_id pattern = timing_pattern;
-    pattern = advance(timing_table, pattern, 65536);
-    return lookup(timing_table, pattern)->pop;
-}
-
 void test_vacuum()
 {
     TEST_START("Testing vacuum function");
@@ -497,16 +461,6 @@ void test_vacuum()
     TEST_OK("Vacuum function verified");
 }
 
-int load_rle_time()
-{
-
-    char *gosper_rle = "24bo11b$22bobo11b$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o14b$2o8b\no3bob2o4bobo11b$10bo5bo7bo11b$11bo3bo20b$12b2o!";
-    node_id pattern = from_rle(timing_table, gosper_rle);
-    return lookup(timing_table, pattern)->pop;
-}
-
-void timeit(int (*func)(void), const char *name, int iters, int warm, int trials);
-
 void test_zeros()
 {
     TEST_START("Testing zero node creation");
@@ -534,9 +488,1181 @@ void test_ffwd()
     TEST_OK("Fast forward function verified");
 }
 
+void test_resumable()
+{
+    TEST_START("Testing resumable advance");
+    node_table *table = create_table(1 << 16);
+    node_id blinker = from_text(table, "OOO");
+    assert(!verify_same(table, advance(table, blinker, 1), "OOO"));
+    assert(verify_same(table, advance(table, blinker, 2), "OOO"));
+    assert(advance(table, blinker, 3) == advance(table, blinker, 1));
+
+    node_id breeder = read_rle(table, "pat/breeder.rle");
+    node_id expected = advance(table, breeder, 1000);
+    assert(expected == advance(table, advance(table, breeder, 999), 1));
+
+    // small leaps with an expired deadline: one step per poll
+    advance_state state;
+    advance_begin(table, &state, breeder, 1000);
+    state.max_j = 4;
+    int polls = 0;
+    while (advance_poll(table, &state, 1) == ADVANCE_RUNNING)
+    {
+        polls++;
+        node *n = lookup(table, advance_result(table, &state));
+        assert(n->pop > 0 && state.generations + state.remaining == 1000);
+    }
+    assert(polls > 1 && state.generations == 1000);
+    assert(advance_result(table, &state) == expected);
+
+    // cancel part way, then carry on from where it stopped
+    advance_begin(table, &state, breeder, 1000);
+    state.max_j = 2;
+    advance_poll(table, &state, 1);
+    state.cancel = true;
+    assert(advance_poll(table, &state, 0) == ADVANCE_CANCELLED);
+    assert(advance(table, advance_result(table, &state), state.remaining) == expected);
+
+    // ffwd counts the generations it actually advanced
+    uint64_t generations;
+    node_id future = ffwd(table, breeder, 3, &generations);
+    assert(future == advance(table, breeder, generations));
+    verify_successor_cache(table);
+    free_table(table);
+    printf("Advanced 1000 generations in %d polls\n", polls + 1);
+    TEST_OK("Resumable advance verified");
+}
+
+void test_stepper()
+{
+    TEST_START("Testing fixed-step stepper");
+    node_table *table = create_table(1 << 16);
+    node_id breeder = read_rle(table, "pat/breeder.rle");
+    uint64_t strides[] = {1, 1024, 1000};
+    for (int i = 0; i < 3; i++)
+    {
+        stepper st;
+        stepper_init(table, &st, breeder, strides[i]);
+        for (int k = 1; k <= 8; k++)
+        {
+            stepper_step(table, &st);
+            assert(st.generation == k * strides[i]);
+            assert(stepper_pattern(table, &st) == advance(table, breeder, st.generation));
+        }
+    }
+
+    // an oscillator stays at the same canonical size, and repeats its root
+    node_id blinker = from_text(table, "OOO");
+    stepper st;
+    stepper_init(table, &st, blinker, 1024);
+    node_id first = stepper_step(table, &st);
+    for (int k = 0; k < 16; k++)
+        assert(stepper_step(table, &st) == first);
+    verify_successor_cache(table);
+    free_table(table);
+    TEST_OK("Fixed-step stepper verified");
+}
+
+void test_pop_series()
+{
+    TEST_START("Testing population series");
+    node_table *table = create_table(1 << 16);
+    char *gosper_gun = "........................O\n......................O.O\n............OO......OO............OO\n...........O...O....OO............OO\nOO........O.....O...OO\nOO........O...O.OO....O.O\n..........O.....O.......O\n...........O...O\n............OO";
+    node_id gun = from_text(table, gosper_gun);
+    pop_sample series[64];
+    uint64_t n = pop_series(table, gun, 0, 300, 10, series, true);
+    assert(n == 31);
+    assert(series[0].pop == 36 && series[0].x0 == 0 && series[0].y0 == 0);
+    assert(series[0].x1 == 35 && series[0].y1 == 8);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        assert(series[i].generation == i * 10);
+        assert(series[i].pop == lookup(table, advance(table, gun, i * 10))->pop);
+        assert(series[i].x0 == 0 && series[i].y0 == 0); // the gun never moves
+    }
+    // the glider stream leaves to the bottom right
+    assert(series[30].x1 > 40 && series[30].y1 > 15);
+
+    // a glider keeps its 3x3 box, and moves 1 cell diagonally every 4 generations
+    node_id glider = from_text(table, ".O\n..O\nOOO");
+    n = pop_series(table, glider, 100, 200, 4, series, true);
+    assert(n == 26);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        int64_t shift = series[i].generation / 4;
+        assert(series[i].pop == 5);
+        assert(series[i].x0 == shift && series[i].y0 == shift);
+        assert(series[i].x1 == shift + 2 && series[i].y1 == shift + 2);
+    }
+
+    // under a B0 rule, a series from an odd generation keeps the phase
+    assert(set_rule(table, "B03/S23") == 0);
+    n = pop_series(table, glider, 1, 9, 2, series, false);
+    assert(n == 5);
+    for (uint64_t i = 0; i < n; i++)
+        assert(series[i].pop == lookup(table, advance(table, glider, series[i].generation))->pop);
+    free_table(table);
+    TEST_OK("Population series verified");
+}
+
+void test_extract()
+{
+    TEST_START("Testing extract");
+    node_table *table = create_table(1 << 12);
+    node_id glider = from_text(table, ".O\n..O\nOOO");
+    node_id moved = from_text(table, ".....\n.....\n.....\n...O\n....O\n..OOO");
+    // the same content, wherever it sits, shifts to the same node
+    assert(extract(table, glider, 0, 0, 2) == extract(table, moved, 2, 3, 2));
+    assert(extract(table, moved, 2, 3, 2) != extract(table, moved, 2, 2, 2));
+    assert(extract(table, glider, -1, -1, 3) == extract(table, moved, 1, 2, 3));
+    assert(extract(table, glider, 100, 0, 4) == get_zero(table, 4));
+    assert(lookup(table, extract(table, moved, -5, -5, 5))->pop == 5);
+    verify_successor_cache(table);
+    free_table(table);
+    TEST_OK("Extract verified");
+}
+
+void test_advance_region()
+{
+    TEST_START("Testing advance_region");
+    node_table *table = create_table(1 << 16), *full = create_table(1 << 16);
+    node_id breeder = read_rle(table, "pat/breeder.rle");
+    node_id whole = read_rle(full, "pat/breeder.rle");
+    // the reference: the whole universe, in a stepper (which keeps id's frame, shifted)
+    stepper st;
+    stepper_init(full, &st, whole, 1000);
+    stepper_step(full, &st);
+    int64_t shift = (1LL << (LEVEL(st.root) - 1)) - (1LL << (LEVEL(whole) - 1));
+    uint64_t full_nodes = full->count;
+
+    uint64_t before = table->count;
+    int64_t windows[][4] = {{0, 0, 64, 64}, {300, 120, 50, 30}, {-700, -40, 200, 100}, {1500, 1500, 8, 8}};
+    for (int i = 0; i < 4; i++)
+    {
+        int64_t x = windows[i][0], y = windows[i][1], w = windows[i][2], h = windows[i][3];
+        node_id region = advance_region(table, breeder, 1000, x, y, w, h);
+        node_id expected = extract(full, st.root, x + shift, y + shift, LEVEL(region));
+        for (int64_t cy = 0; cy < h; cy++)
+            for (int64_t cx = 0; cx < w; cx++)
+                assert(get_cell(table, region, cx, cy, 0) == get_cell(full, expected, cx, cy, 0));
+    }
+    printf("advance_region made %llu nodes, the whole universe %llu\n",
+           (unsigned long long)(table->count - before), (unsigned long long)full_nodes);
+    assert(table->count - before < full_nodes);
+
+    // odd steps, and a B0 rule
+    node_id glider = from_text(table, ".O\n..O\nOOO");
+    node_id moved = advance_region(table, glider, 40, 10, 10, 4, 4);
+    assert(lookup(table, moved)->pop == 5 && get_cell(table, moved, 1, 0, 0) == 1.0);
+    assert(advance_region(table, glider, UINT64_MAX, 0, 0, 4, 4) == UNUSED); // too far to fit the frame
+    assert(set_rule(table, "B026/S1") == 0);
+    node_id soup = random_soup(table, 5, 0, 16);
+    node_id all = advance(table, soup, 33);
+    node_id part = advance_region(table, soup, 33, -48, -48, 128, 128);
+    assert(lookup(table, all)->pop == lookup(table, part)->pop);
+    verify_successor_cache(table);
+    free_table(full);
+    free_table(table);
+    TEST_OK("advance_region verified");
+}
+
+void test_cell_iter()
+{
+    TEST_START("Testing live cell iteration");
+    node_table *table = create_table(1 << 16);
+    node_id breeder = advance(table, read_rle(table, "pat/breeder.rle"), 100);
+    uint64_t pop = lookup(table, breeder)->pop;
+    int64_t *all = malloc(2 * pop * sizeof(int64_t)), chunk[2 * 3];
+    cell_iter it;
+
+    // in one go
+    cell_iter_init(table, &it, breeder, 0, 0);
+    assert(cell_iter_next(&it, all, pop + 1) == pop);
+    assert(cell_iter_next(&it, all, pop + 1) == 0);
+    for (uint64_t i = 0; i < pop; i++)
+        assert(get_cell(table, breeder, all[2 * i], all[2 * i + 1], 0) == 1.0);
+
+    // in chunks of three, with an offset: the same cells in the same order
+    uint64_t n, seen = 0;
+    cell_iter_init(table, &it, breeder, -5, 7);
+    while ((n = cell_iter_next(&it, chunk, 3)) > 0)
+        for (uint64_t i = 0; i < n; i++, seen++)
+            assert(chunk[2 * i] == all[2 * seen] - 5 && chunk[2 * i + 1] == all[2 * seen + 1] + 7);
+    assert(seen == pop);
+
+    // clipped to a rectangle around a cell half way through
+    int64_t x0 = all[pop - pop % 2] - 30, y0 = all[pop - pop % 2 + 1] - 10, x1 = x0 + 75, y1 = y0 + 40;
+    uint64_t inside = 0;
+    for (uint64_t i = 0; i < pop; i++)
+        inside += all[2 * i] >= x0 && all[2 * i] < x1 && all[2 * i + 1] >= y0 && all[2 * i + 1] < y1;
+    cell_iter_init(table, &it, breeder, 0, 0);
+    cell_iter_clip(&it, x0, y0, x1, y1);
+    for (seen = 0; (n = cell_iter_next(&it, chunk, 3)) > 0; seen += n)
+        for (uint64_t i = 0; i < n; i++)
+            assert(chunk[2 * i] >= x0 && chunk[2 * i] < x1 && chunk[2 * i + 1] >= y0 && chunk[2 * i + 1] < y1);
+    assert(seen == inside && inside > 0);
+    printf("%llu live cells, %llu in the clip rectangle\n", (unsigned long long)pop, (unsigned long long)inside);
+    free(all);
+    free_table(table);
+    TEST_OK("Live cell iteration verified");
+}
+
+void test_fork()
+{
+    TEST_START("Testing table forks");
+    node_table *base = create_table(1 << 16), *fresh = create_table(1 << 16);
+    node_id breeder = read_rle(base, "pat/breeder.rle");
+    advance(base, breeder, 1024); // warm the base
+    uint64_t base_count = base->count;
+    char *base_rle = to_rle(base, breeder);
+
+    // a fork redoes nothing the base has done, and only stores what is new
+    node_table *fork = fork_table(base, 64);
+    node_id future = advance(fork, breeder, 1024);
+    assert(fork->count < 64);
+    future = advance(fork, future, 1000);
+    char *rle = to_rle(fork, future), *expected = to_rle(fresh, advance(fresh, read_rle(fresh, "pat/breeder.rle"), 2024));
+    assert(!strcmp(rle, expected));
+    printf("Base %llu nodes, fork %llu of its own\n", (unsigned long long)base_count, (unsigned long long)fork->count);
+    free(rle);
+    free(expected);
+    verify_hashtable(fork);
+    verify_successor_cache(fork);
+
+    // a perturbed branch, vacuumed on its own, under another rule
+    node_table *branch = fork_table(base, 64);
+    node_id changed = set_cell(branch, breeder, 3, 3, true);
+    changed = advance(branch, changed, 500);
+    vacuum(branch, changed);
+    assert(set_rule(branch, "B36/S23") == 0 && !branch->parent_successors);
+    changed = advance(branch, changed, 100);
+    node_id reference = set_cell(fresh, read_rle(fresh, "pat/breeder.rle"), 3, 3, true);
+    reference = advance(fresh, reference, 500);
+    assert(set_rule(fresh, "B36/S23") == 0);
+    reference = advance(fresh, reference, 100);
+    rle = to_rle(branch, changed), expected = to_rle(fresh, reference);
+    assert(!strcmp(rle, expected));
+    free(rle);
+    free(expected);
+
+    // forks of forks, and the base is untouched throughout
+    node_table *grandchild = fork_table(fork, 64);
+    assert(lookup(grandchild, advance(grandchild, breeder, 2024))->pop == lookup(fork, future)->pop);
+    free_table(grandchild);
+    free_table(branch);
+    free_table(fork);
+    assert(base->count == base_count);
+    rle = to_rle(base, breeder);
+    assert(!strcmp(rle, base_rle));
+    verify_hashtable(base);
+    free(rle);
+    free(base_rle);
+    free_table(fresh);
+    free_table(base);
+    TEST_OK("Table forks verified");
+}
+
+void test_edits()
+{
+    TEST_START("Testing batched edits");
+    node_table *table = create_table(1 << 12), *single = create_table(1 << 12);
+    node_id base = read_rle(table, "pat/breeder.rle");
+    node_id one = read_rle(single, "pat/breeder.rle");
+    uint64_t before = table->count, before_single = single->count;
+
+    // random edits, some to the same cell, some outside the pattern
+    enum { N = 3000 };
+    cell_edit *edits = malloc(N * sizeof(cell_edit));
+    uint64_t state = 42;
+    for (int i = 0; i < N; i++)
+    {
+        state = mix64(state + i);
+        edits[i] = (cell_edit){state % 900, (state >> 20) % 700, (state >> 40) & 1};
+        if (i % 10 == 9)
+            edits[i].x = edits[i - 1].x, edits[i].y = edits[i - 1].y; // the later one wins
+        one = set_cell(single, one, edits[i].x, edits[i].y, edits[i].state);
+    }
+    node_id batch = apply_edits(table, base, edits, N);
+    char *expected = to_rle(single, one), *rle = to_rle(table, batch);
+    assert(!strcmp(rle, expected));
+    printf("%d edits: %llu new nodes in one pass, %llu one at a time\n", N,
+           (unsigned long long)(table->count - before), (unsigned long long)(single->count - before_single));
+    assert(table->count - before < single->count - before_single);
+    free(rle);
+    free(expected);
+
+    // set many, then clear a rectangle
+    uint64_t xy[] = {1, 1, 2, 1, 3, 1, 40, 40};
+    node_id id = set_cells(table, get_zero(table, 2), xy, 4);
+    assert(lookup(table, id)->pop == 4 && get_cell(table, id, 40, 40, 0) == 1.0);
+    assert(lookup(table, clear_rect(table, id, 2, 0, 100, 2))->pop == 2);
+
+    // cells past 2^32 have no Morton key, and are set one at a time
+    cell_edit far[] = {{1, 1, true}, {1ULL << 40, 3, true}, {2, 1, true}, {1ULL << 40, 3, false}, {5, 1ULL << 35, true}};
+    id = apply_edits(table, get_zero(table, 2), far, 5);
+    assert(lookup(table, id)->pop == 3 && get_cell(table, id, 5, 1ULL << 35, 0) == 1.0);
+    assert(get_cell(table, id, 1ULL << 40, 3, 0) == 0.0 && get_cell(table, id, 2, 1, 0) == 1.0);
+    node_id cleared = clear_rect(table, batch, 100, 50, 333, 222);
+    for (uint64_t y = 0; y < 700; y++)
+        for (uint64_t x = 0; x < 900; x++)
+            if (x >= 100 && x < 433 && y >= 50 && y < 272)
+                batch = set_cell(table, batch, x, y, false);
+    assert(cleared == batch);
+    verify_hashtable(table);
+    free(edits);
+    free_table(single);
+    free_table(table);
+    TEST_OK("Batched edits verified");
+}
+
+/* Read a pattern from text through a stream, as read_life_file() would */
+static node_id read_life_string(node_table *table, const char *text)
+{
+    FILE *f = tmpfile();
+    fputs(text, f);
+    rewind(f);
+    node_id id = read_life_stream(table, f);
+    fclose(f);
+    return id;
+}
+
+void test_life_formats()
+{
+    TEST_START("Testing Life 1.05, Life 1.06 and plaintext readers");
+    node_table *table = create_table(1 << 12);
+    // a glider and, far up and to the left, a blinker
+    char *expected = ".......................O\n........................O\n......................OOO\n"
+                     "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\nOOO";
+    const char *texts[] = {
+        "#Life 1.05\n#D two blocks\n#N\n#P -3 -23\n.*\n..*\n***\n#P -25 -1\n***\n",
+        "#Life 1.06\n-2 -23\n-1 -22\n-3 -21\n-2 -21\n-1 -21\n-25 -1\n-24 -1\n-23 -1\n",
+        "!Name: glider and blinker\n.......................O\n........................O\n......................OOO\n"
+        "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\nOOO\n",
+        "!DBLife repeat counts\n23.O\n24.O\n22.3O\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n3O\n",
+        "#C RLE still works\nx = 25, y = 23\n23bo$24bo$22b3o20$3o!\n",
+    };
+    for (int i = 0; i < 5; i++)
+    {
+        node_id id = read_life_string(table, texts[i]);
+        assert(lookup(table, id)->pop == 8 && verify_same(table, id, expected));
+    }
+    // the lifep corpus: a methuselah and a Life 1.06 collection
+    assert(set_rule(table, "B36/S23") == 0);
+    node_id acorn = read_life_file(table, "../lifep/ACORN.LIF");
+    assert(!strcmp(table->rule.name, "B3/S23")); // from #N
+    assert(lookup(table, acorn)->pop == 7);
+    assert(lookup(table, advance(table, acorn, 5206))->pop == 633);
+    assert(lookup(table, read_life_file(table, "../lifep/OSCSP4.LIF"))->pop == 2376);
+    free_table(table);
+    TEST_OK("Life file readers verified");
+}
+
+struct diff_check
+{
+    node_table *table;
+    uint64_t tiles, flips;
+};
+
+static void check_tile(void *ctx, int64_t x, int64_t y, uint64_t level, node_id before, node_id after)
+{
+    struct diff_check *check = ctx;
+    assert(before != after && LEVEL(before) == level && LEVEL(after) == level);
+    assert((x & ((1LL << level) - 1)) == 0 && (y & ((1LL << level) - 1)) == 0);
+    check->tiles++;
+    check->flips += diff(check->table, before, x, y, after, x, y, 0, NULL, NULL);
+}
+
+void test_diff()
+{
+    TEST_START("Testing structural diff");
+    node_table *table = create_table(1 << 16);
+    // a glider, four generations on, in the same frame
+    stepper st;
+    stepper_init(table, &st, from_text(table, ".O\n..O\nOOO"), 4);
+    node_id before = st.root, after = stepper_step(table, &st);
+    assert(LEVEL(before) == LEVEL(after));
+    uint64_t size = 1ULL << LEVEL(before), flips = 0;
+    for (uint64_t y = 0; y < size; y++)
+        for (uint64_t x = 0; x < size; x++)
+            flips += get_cell(table, before, x, y, 0) != get_cell(table, after, x, y, 0);
+    assert(diff(table, before, 0, 0, after, 0, 0, 0, NULL, NULL) == flips && flips > 0);
+    // ...and nothing at all once the move is allowed for, whatever the frames
+    assert(diff(table, before, 1, 1, after, 0, 0, 0, NULL, NULL) == 0);
+    assert(diff(table, before, -7, 5, centre(table, after), -8 - (int64_t)size / 2, 4 - (int64_t)size / 2, 0, NULL, NULL) == 0);
+
+    // a breeder: each changed tile holds exactly the cell flips inside it
+    node_id breeder = read_rle(table, "pat/breeder.rle");
+    stepper_init(table, &st, breeder, 64);
+    before = st.root;
+    after = stepper_step(table, &st);
+    struct diff_check check = {table, 0, 0};
+    uint64_t tiles = diff(table, before, 0, 0, after, 0, 0, 4, check_tile, &check);
+    assert(tiles > 0 && check.tiles == tiles);
+    assert(check.flips == diff(table, before, 0, 0, after, 0, 0, 0, NULL, NULL));
+    printf("Breeder, 64 generations: %llu tiles of 16x16 changed, %llu cells flipped\n",
+           (unsigned long long)tiles, (unsigned long long)check.flips);
+    free_table(table);
+    TEST_OK("Structural diff verified");
+}
+
+#define MAX_FOUND 4096
+struct found
+{
+    uint64_t n;
+    int64_t x[MAX_FOUND], y[MAX_FOUND];
+    int t[MAX_FOUND];
+};
+
+static void record_match(void *ctx, int64_t x, int64_t y, int t)
+{
+    struct found *f = ctx;
+    if (f->n < MAX_FOUND)
+    {
+        f->x[f->n] = x;
+        f->y[f->n] = y;
+        f->t[f->n] = t;
+    }
+    f->n++;
+}
+
+static bool was_found(const struct found *f, int64_t x, int64_t y)
+{
+    for (uint64_t i = 0; i < f->n && i < MAX_FOUND; i++)
+        if (f->x[i] == x && f->y[i] == y)
+            return true;
+    return false;
+}
+
+void test_search()
+{
+    TEST_START("Testing subpattern search");
+    node_table *table = create_table(1 << 16);
+    static struct found found;
+
+    // blocks in evolved ash, against a cell by cell scan (a block with one dead cell all round)
+    node_id ash = advance(table, read_rle(table, "pat/breeder.rle"), 300);
+    node_id block = from_text(table, "OO\nOO");
+    found.n = 0;
+    uint64_t n = find_pattern(table, ash, block, 1, true, record_match, &found);
+    assert(n == found.n && n <= MAX_FOUND);
+    int64_t size = 1LL << LEVEL(ash), brute = 0;
+    for (int64_t y = -1; y < size; y++)
+        for (int64_t x = -1; x < size; x++)
+        {
+            bool match = true;
+            for (int64_t j = -1; j < 3 && match; j++)
+                for (int64_t i = -1; i < 3 && match; i++)
+                {
+                    bool live = (i == 0 || i == 1) && (j == 0 || j == 1);
+                    uint64_t cx = (uint64_t)(x + i), cy = (uint64_t)(y + j); // negative is out of range
+                    match = (get_cell(table, ash, cx, cy, 0) == 1.0f) == live;
+                }
+            if (match)
+            {
+                brute++;
+                assert(was_found(&found, x, y));
+            }
+        }
+    for (uint64_t i = 0; i < n; i++)
+        assert(found.t[i] == 0); // all eight orientations of a block look the same
+    assert((uint64_t)brute == n && n > 0);
+    printf("%llu isolated blocks in the breeder at generation 300\n", (unsigned long long)n);
+
+    // a glider in each orientation, each found at its own corner
+    node_id glider = from_text(table, ".O\n..O\nOOO");
+    node_id universe = get_zero(table, 9);
+    int64_t xs[8], ys[8];
+    for (int t = 0; t < 8; t++)
+    {
+        int64_t x0, y0, x1, y1, xy[2 * 8];
+        node_id g = transform(table, glider, t);
+        bounding_box(table, g, &x0, &y0, &x1, &y1);
+        xs[t] = 17 + 50 * t;
+        ys[t] = 400 - 45 * t;
+        cell_iter it;
+        cell_iter_init(table, &it, g, xs[t] - x0, ys[t] - y0);
+        uint64_t cells = cell_iter_next(&it, xy, 8);
+        for (uint64_t i = 0; i < cells; i++)
+            universe = set_cell(table, universe, xy[2 * i], xy[2 * i + 1], true);
+    }
+    found.n = 0;
+    assert(find_pattern(table, universe, glider, 1, true, record_match, &found) == 8);
+    for (int t = 0; t < 8; t++)
+        assert(was_found(&found, xs[t], ys[t]));
+    found.n = 0;
+    assert(find_pattern(table, universe, glider, 1, false, record_match, &found) >= 1);
+    assert(was_found(&found, xs[0], ys[0]) && found.t[0] == 0);
+
+    // a universe tiled with one glider: the count is memoised per node, not per copy
+    node_id tile = centre(table, centre(table, glider)), tiled = tile;
+    for (int i = 0; i < 14; i++)
+        tiled = join(table, tiled, tiled, tiled, tiled);
+    assert(find_pattern(table, tiled, glider, 1, false, NULL, NULL) == 1ULL << 28);
+    assert(find_pattern(table, tiled, from_text(table, "O\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO\nO"),
+                        0, false, NULL, NULL) == SEARCH_TOO_LARGE);
+    printf("2^28 gliders found in a tiled universe of level %llu\n", (unsigned long long)LEVEL(tiled));
+    free_table(table);
+    TEST_OK("Subpattern search verified");
+}
+
+void test_period()
+{
+    TEST_START("Testing period detection");
+    node_table *table = create_table(1 << 16);
+    period_info info;
+    assert(find_period(table, from_text(table, "OOO"), 100, &info));
+    assert(info.period == 2 && info.dx == 0 && info.dy == 0 && info.first == 0);
+
+    node_id glider = from_text(table, ".O\n..O\nOOO");
+    assert(find_period(table, glider, 100, &info));
+    assert(info.period == 4 && info.dx == 1 && info.dy == 1 && info.first == 0);
+    // the history grows as it is stepped, so a generous limit costs nothing up front
+    assert(find_period(table, glider, 1ULL << 40, &info) && info.period == 4);
+
+    // eventually periodic: a block after one generation, empty after two
+    assert(find_period(table, from_text(table, "OO\nO."), 100, &info));
+    assert(info.period == 1 && info.first == 1);
+    assert(find_period(table, from_text(table, "O..\n.O.\n..O"), 100, &info));
+    assert(info.period == 1 && info.first == 2);
+
+    // the gun keeps growing
+    char *gosper_gun = "........................O\n......................O.O\n............OO......OO............OO\n...........O...O....OO............OO\nOO........O.....O...OO\nOO........O...O.OO....O.O\n..........O.....O.......O\n...........O...O\n............OO";
+    assert(!find_period(table, from_text(table, gosper_gun), 120, &info));
+
+    // skip a glider a long way ahead
+    int64_t dx, dy;
+    assert(find_period(table, glider, 100, &info));
+    node_id far = period_skip(table, glider, &info, 1000003, &dx, &dy);
+    assert(dx == 250000 && dy == 250000);
+    char *expected = to_text(table, advance(table, glider, 3));
+    assert(verify_same(table, far, expected));
+    free(expected);
+
+    // under B0 rules a repeat must keep the phase: this block's stored nodes
+    // repeat every generation, but the pattern itself flashes with period 2
+    assert(set_rule(table, "B026/S1") == 0);
+    node_id block = from_text(table, "OO\nOO");
+    assert(find_period(table, block, 100, &info));
+    assert(info.period == 2 && info.first == 2 && info.dx == 0 && info.dy == 0);
+    expected = to_text(table, crop(table, advance(table, block, 7)));
+    assert(verify_same(table, crop(table, period_skip(table, block, &info, 1001, &dx, &dy)), expected));
+    free(expected);
+    verify_successor_cache(table);
+    free_table(table);
+    TEST_OK("Period detection verified");
+}
+
+void test_soup()
+{
+    TEST_START("Testing soup search");
+    node_table *table = create_table(1 << 12);
+    assert(random_soup(table, 1, 5, 16) == random_soup(table, 1, 5, 16));
+    assert(random_soup(table, 1, 5, 16) != random_soup(table, 1, 6, 16));
+    assert(random_soup(table, 1, 5, 16) != random_soup(table, 2, 5, 16));
+
+    // close objects that never interact are counted apart; a pulsar's quarters do interact
+    census ash;
+    census_init(&ash);
+    assert(census_pattern(table, from_text(table, "OO\nOO\n..\nOO\nOO"), &ash));
+    assert(census_pattern(table, from_text(table, "OOO.OOO"), &ash));
+    assert(ash.n == 2);
+    for (uint64_t i = 0; i < ash.size; i++)
+        if (ash.entries[i].key)
+            assert(ash.entries[i].count == 2 && (!strcmp(ash.entries[i].rle, "2o$2o!") || !strcmp(ash.entries[i].rle, "o$o$o!")));
+    census_free(&ash);
+    census_init(&ash);
+    char *pulsar = "..OOO...OOO\n\n"
+                   "O....O.O....O\nO....O.O....O\nO....O.O....O\n..OOO...OOO\n\n..OOO...OOO\n"
+                   "O....O.O....O\nO....O.O....O\nO....O.O....O\n\n..OOO...OOO";
+    assert(census_pattern(table, from_text(table, pulsar), &ash));
+    assert(ash.n == 1);
+    for (uint64_t i = 0; i < ash.size; i++)
+        if (ash.entries[i].key)
+            assert(ash.entries[i].count == 1 && ash.entries[i].period == 3);
+    census_free(&ash);
+    free_table(table);
+
+    soup_params params;
+    soup_params_default(&params);
+    params.seed = 42;
+    params.n_soups = 12;
+    params.soup_size = 10;
+    census one, many;
+    soup_search(&params, &one);
+    params.threads = 3;
+    soup_search(&params, &many);
+    assert(one.soups == 12 && many.soups == 12 && one.n == many.n);
+    for (uint64_t i = 0; i < one.size; i++)
+        if (one.entries[i].key)
+        {
+            census_entry *e = census_find(&many, one.entries[i].key);
+            assert(e->count == one.entries[i].count && !strcmp(e->rle, one.entries[i].rle));
+        }
+    // blocks are the commonest object, whichever way round they are found
+    census_entry *block = NULL;
+    for (uint64_t i = 0; i < one.size; i++)
+        if (one.entries[i].key && !strcmp(one.entries[i].rle, "2o$2o!"))
+            block = &one.entries[i];
+    assert(block && block->pop == 4 && block->period == 1);
+    printf("Found %llu kinds of object in %llu soups\n", (unsigned long long)one.n, (unsigned long long)one.soups);
+    census_free(&one);
+    census_free(&many);
+    TEST_OK("Soup search verified");
+}
+
+void test_symmetry()
+{
+    TEST_START("Testing symmetric successors");
+    node_table *plain = create_table(1 << 16), *sym = create_table(1 << 16);
+    set_symmetry(sym, 4);
+    char *gosper_gun = "........................O\n......................O.O\n............OO......OO............OO\n...........O...O....OO............OO\nOO........O.....O...OO\nOO........O...O.OO....O.O\n..........O.....O.......O\n...........O...O\n............OO";
+    node_table *tables[2] = {plain, sym};
+    char *text[2];
+    for (int i = 0; i < 2; i++)
+    {
+        node_table *table = tables[i];
+        node_id gun = from_text(table, gosper_gun);
+        // every transform, and its inverse, round trips
+        for (int t = 0; t < 8; t++)
+            assert(transform(table, transform(table, gun, t), inverse_transform(t)) == gun);
+        assert(find_transform(table, gun, 5) == transform(table, gun, 5));
+        // four guns, mirrored into each quadrant
+        node_id a = centre(table, centre(table, gun));
+        node_id b = transform(table, a, 1), c = transform(table, a, 2), d = transform(table, a, 3);
+        node_id guns = join(table, a, b, c, d);
+        text[i] = to_text(table, advance(table, guns, 200));
+    }
+    assert(!strcmp(text[0], text[1]));
+    printf("Nodes: %llu plain, %llu symmetric\n", (unsigned long long)plain->count, (unsigned long long)sym->count);
+    assert(sym->count < plain->count);
+    verify_successor_cache(sym);
+    free(text[0]);
+    free(text[1]);
+    free_table(plain);
+    free_table(sym);
+    TEST_OK("Symmetric successors verified");
+}
+
+/* Run a plain text pattern for gens generations on a flat grid, directly from the rule */
+static char *naive_run(const char *text, const life_rule *rule, int gens)
+{
+    enum { N = 96, O = 40 };
+    static uint8_t grid[N][N], next[N][N];
+    memset(grid, 0, sizeof(grid));
+    uint8_t background = 0; // flips every generation under B0
+    int x = 0, y = 0;
+    for (const char *p = text; *p; p++)
+        if (*p == '\n')
+            y++, x = 0;
+        else
+            grid[O + y][O + x++] = *p == 'O';
+    for (int g = 0; g < gens; g++)
+    {
+        background = rule->next[background ? 511 : 0];
+        memset(next, background, sizeof(next));
+        for (int j = 1; j < N - 1; j++)
+            for (int i = 1; i < N - 1; i++)
+            {
+                int index = 0;
+                for (int bit = 0; bit < 9; bit++)
+                    index |= grid[j - 1 + bit / 3][i - 1 + bit % 3] << bit;
+                next[j][i] = rule->next[index];
+            }
+        memcpy(grid, next, sizeof(grid));
+    }
+    char *out = malloc(N * (N + 1) + 1), *p = out;
+    for (int j = 0; j < N; j++)
+    {
+        for (int i = 0; i < N; i++)
+            *p++ = grid[j][i] ? 'O' : '.';
+        *p++ = '\n';
+    }
+    *p = 0;
+    return out;
+}
+
+void test_rules()
+{
+    TEST_START("Testing Life-like rules");
+    life_rule rule;
+    assert(parse_rule("B36/S23", &rule) == 0 && !strcmp(rule.name, "B36/S23"));
+    assert(parse_rule("b3678s34678", &rule) == 0 && !strcmp(rule.name, "B3678/S34678"));
+    assert(parse_rule("23/36", &rule) == 0 && !strcmp(rule.name, "B36/S23"));
+    assert(parse_rule("B3/S29", &rule) == -1 && parse_rule("B3", &rule) == -1 && parse_rule("Q3/S2", &rule) == -1);
+
+    const char *rules[] = {"B3/S23", "B36/S23", "B3678/S34678", "B2/S"};
+    node_table *table = create_table(1 << 12);
+    node_id soup = random_soup(table, 3, 0, 16);
+    char *soup_text = to_text(table, soup);
+    for (int i = 0; i < 4; i++)
+    {
+        assert(set_rule(table, rules[i]) == 0);
+        char *expected = naive_run(soup_text, &table->rule, 20);
+        assert(verify_same(table, advance(table, soup, 20), expected));
+        free(expected);
+    }
+    assert(set_rule(table, "B0/S8") == -1 && !strcmp(table->rule.name, "B2/S"));
+
+    // each count's Hensel letters split its neighbourhoods between them
+    for (int n = 1; n < 8; n++)
+    {
+        const char *letters[] = {"ce", "ceaikn", "ceaiknjqry", "ceaiknjqrtwyz"};
+        const char *mine = letters[n <= 4 ? n - 1 : 7 - n];
+        char text[16];
+        life_rule all, part;
+        sprintf(text, "B%d/S", n);
+        assert(parse_rule(text, &all) == 0);
+        int covered[512] = {0};
+        for (const char *l = mine; *l; l++)
+        {
+            sprintf(text, "B%d%c/S", n, *l);
+            assert(parse_rule(text, &part) == 0 && !strcmp(part.name, text));
+            int count = 0;
+            for (int i = 0; i < 512; i++)
+                if (part.next[i])
+                    covered[i]++, count++;
+            assert(count > 0);
+        }
+        for (int i = 0; i < 512; i++)
+            assert(covered[i] == all.next[i]);
+    }
+    assert(parse_rule("B3ceaiknjqry/S2ceaikn3", &rule) == 0 && !strcmp(rule.name, "B3/S23"));
+    assert(parse_rule("B2-a/S12", &rule) == 0 && !strcmp(rule.name, "B2-a/S12"));
+    assert(parse_rule("B2cekin/S", &rule) == 0 && !strcmp(rule.name, "B2-a/S"));
+    assert(parse_rule("B2j/S", &rule) == -1 && parse_rule("B2-/S", &rule) == -1);
+
+    // non-totalistic and B0 rules (B0 patterns are stored inverted at odd generations)
+    const char *more[] = {"B2a/S12-e", "B34ce5j/S23-a4i", "B01245/S0124", "B026/S1"};
+    for (int i = 0; i < 4; i++)
+    {
+        assert(set_rule(table, more[i]) == 0);
+        assert(table->rule.alternating == (i >= 2));
+        for (int gens = 20; gens <= 21; gens++)
+        {
+            char *expected = naive_run(soup_text, &table->rule, gens);
+            if (table->rule.alternating && gens & 1)
+                for (char *p = expected; *p; p++)
+                    *p = *p == 'O' ? '.' : *p == '.' ? 'O' : *p;
+            assert(verify_same(table, advance(table, soup, gens), expected));
+            free(expected);
+        }
+    }
+    // a stepper with an odd step keeps track of the phase
+    stepper st;
+    stepper_init(table, &st, soup, 3);
+    stepper_step(table, &st);
+    stepper_step(table, &st);
+    char *six = to_text(table, advance(table, soup, 6));
+    assert(verify_same(table, stepper_pattern(table, &st), six));
+    free(six);
+
+    // the rule travels with the RLE
+    node_id id = from_rle(table, "#C rule = B0\nx = 3, y = 1, rule = B36/S23\n3o!");
+    assert(!strcmp(table->rule.name, "B36/S23"));
+    char *rle = to_rle(table, id);
+    assert(strstr(rle, "rule = B36/S23"));
+    free(rle);
+    free(soup_text);
+    verify_successor_cache(table);
+    free_table(table);
+    TEST_OK("Life-like rules verified");
+}
+
+void test_stats()
+{
+    TEST_START("Testing engine statistics");
+    node_table *table = create_table(64);
+    node_id gun = read_rle(table, "pat/breeder.rle");
+    uint64_t created = table->count - 2; // on and off are not joined
+    table_stats *s = &table->stats;
+#if HL_STATS
+    assert(s->join_misses == created);
+    assert(s->resizes > 0);
+#endif
+    reset_stats(table);
+    uint64_t before = table->count;
+    node_id future = advance(table, gun, 256);
+    uint64_t succ_hits = 0, succ_misses = 0, succ_hits_j = 0, probes = 0;
+    for (int i = 0; i < STATS_LEVELS; i++)
+    {
+        succ_hits += s->succ_hits[i];
+        succ_misses += s->succ_misses[i];
+        succ_hits_j += s->succ_hits_j[i];
+    }
+    for (int i = 0; i < STATS_PROBES; i++)
+        probes += s->probe_hist[i];
+#if HL_STATS
+    assert(s->join_misses == table->count - before);
+    assert(succ_misses > 0 && succ_hits == succ_hits_j);
+    assert(probes > 0);
+#endif
+    (void)created, (void)before;
+    vacuum(table, future);
+#if HL_STATS
+    assert(s->vacuums == 1 && s->vacuum_survivors == table->count);
+#endif
+    uint64_t levels[STATS_LEVELS], total = 0;
+    count_levels(table, levels);
+    for (int i = 0; i < STATS_LEVELS; i++)
+        total += levels[i];
+    assert(total == table->count);
+    print_stats(table, stdout);
+    free_table(table);
+    TEST_OK("Engine statistics verified");
+}
+
+void test_trace()
+{
+    TEST_START("Testing trace events");
+    node_table *table = create_table(64);
+    node_id gun = read_rle(table, "pat/breeder.rle");
+    advance(table, gun, 64);
+    assert(trace_count() == 0); // nothing recorded while disabled
+    trace_start(6);
+    node_id future = advance(table, gun, 300);
+    vacuum(table, future);
+    trace_stop();
+    uint64_t count = trace_count();
+#if HL_TRACE
+    assert(count > 0);
+#endif
+    advance(table, future, 16);
+    assert(trace_count() == count);
+    assert(trace_write_json("test_trace.json") == 0);
+    FILE *f = fopen("test_trace.json", "r");
+    char head[32] = {0};
+    assert(f && fread(head, 1, sizeof(head) - 1, f) > 0);
+    assert(strstr(head, "{\"displayTimeUnit\"") == head);
+    fclose(f);
+    remove("test_trace.json");
+    trace_clear();
+    free_table(table);
+    printf("Recorded %llu trace events\n", (unsigned long long)count);
+    TEST_OK("Trace events verified");
+}
+
+/* Run one server command, returning the first line of the reply */
+static char *serve_reply(server *srv, const char *command, char *reply, int len)
+{
+    char line[SERVE_LINE_LEN];
+    FILE *out = tmpfile();
+    strcpy(line, command);
+    serve_command(srv, line, out);
+    rewind(out);
+    assert(fgets(reply, len, out));
+    fclose(out);
+    return reply;
+}
+
+static const char *find_job_rule(server *srv, const char *name)
+{
+    for (int i = 0; i < srv->n_jobs; i++)
+        if (!strcmp(srv->jobs[i].name, name))
+            return srv->jobs[i].rule;
+    return NULL;
+}
+
+void test_serve()
+{
+    TEST_START("Testing server mode");
+    static server srv;
+    char reply[256];
+    serve_init(&srv, create_table(64));
+    assert(!strncmp(serve_reply(&srv, "load a pat/breeder.rle", reply, sizeof(reply)), "ok", 2));
+    assert(!strncmp(serve_reply(&srv, "advance a 512", reply, sizeof(reply)), "ok", 2));
+    uint64_t warm = srv.table->count;
+    // the same job again reuses the warm table: no new nodes at all
+    serve_reply(&srv, "load b pat/breeder.rle", reply, sizeof(reply));
+    serve_reply(&srv, "advance b 512", reply, sizeof(reply));
+    assert(srv.table->count == warm);
+    assert(srv.jobs[0].root == srv.jobs[1].root);
+
+    // vacuum keeps every pinned job alive
+    serve_reply(&srv, "drop a", reply, sizeof(reply));
+    node_id b = srv.jobs[0].root;
+    uint64_t pop = lookup(srv.table, b)->pop;
+    serve_reply(&srv, "vacuum", reply, sizeof(reply));
+    assert(srv.table->count < warm);
+    assert(lookup(srv.table, b)->pop == pop);
+    verify_hashtable(srv.table);
+    verify_tree(srv.table, b, LEVEL(b));
+
+    assert(!strncmp(serve_reply(&srv, "info a", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&srv, "load c no/such/file.rle", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&srv, "frobnicate", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&srv, "info b", reply, sizeof(reply)), "ok", 2));
+
+    // loading a pattern under another rule leaves the table's rule (and warm cache) as it was
+    FILE *rle = fopen("test_serve.rle", "w");
+    fputs("x = 3, y = 1, rule = B36/S23\n3o!\n", rle);
+    fclose(rle);
+    assert(!strncmp(serve_reply(&srv, "load h test_serve.rle", reply, sizeof(reply)), "ok", 2));
+    assert(!strcmp(srv.table->rule.name, "B3/S23") && !strcmp(find_job_rule(&srv, "h"), "B36/S23"));
+    // a shared table keeps its own rule, so such a job cannot be advanced there
+    static server fixed;
+    serve_init(&fixed, open_shared_table("/hashlife_test_serve", 1 << 12, NULL));
+    assert(!strncmp(serve_reply(&fixed, "load h test_serve.rle", reply, sizeof(reply)), "ok", 2));
+    assert(!strncmp(serve_reply(&fixed, "advance h 1", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&fixed, "write h", reply, sizeof(reply)), "error", 5));
+    free_table(fixed.table);
+    assert(unlink_shared_table("/hashlife_test_serve") == 0);
+    rle = fopen("test_serve.rle", "w");
+    fputs("x = 3, y = 1, rule = B9/S9\n3o!\n", rle);
+    fclose(rle);
+    assert(!strncmp(serve_reply(&srv, "load u test_serve.rle", reply, sizeof(reply)), "error", 5));
+
+    // under a B0 rule, a job advanced in odd steps matches one advanced in a single step
+    rle = fopen("test_serve.rle", "w");
+    fputs("x = 3, y = 3, rule = B026/S1\nb2o$2o$bo!\n", rle);
+    fclose(rle);
+    assert(!strncmp(serve_reply(&srv, "load z test_serve.rle", reply, sizeof(reply)), "ok", 2));
+    node_id z = from_rle(srv.table, "x = 3, y = 3, rule = B026/S1\nb2o$2o$bo!\n");
+    assert(srv.table->rule.alternating);
+    serve_reply(&srv, "advance z 1", reply, sizeof(reply));
+    assert(!strncmp(serve_reply(&srv, "write z", reply, sizeof(reply)), "#C", 2));
+    serve_reply(&srv, "advance z 3", reply, sizeof(reply));
+    assert(!strcmp(find_job_rule(&srv, "z"), srv.table->rule.name));
+    for (int i = 0; i < srv.n_jobs; i++)
+        if (!strcmp(srv.jobs[i].name, "z"))
+            assert(srv.jobs[i].generation == 4 && srv.jobs[i].root == advance(srv.table, z, 4));
+    remove("test_serve.rle");
+
+    // files are only written under the working directory
+    assert(!strncmp(serve_reply(&srv, "write z /tmp/test_serve.rle", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&srv, "write z pat/../../test_serve.rle", reply, sizeof(reply)), "error", 5));
+    assert(!strncmp(serve_reply(&srv, "write z test_serve..rle", reply, sizeof(reply)), "ok", 2));
+    remove("test_serve..rle");
+
+    FILE *in = tmpfile(), *out = tmpfile();
+    fputs("info b\nquit\ninfo b\n", in);
+    rewind(in);
+    assert(serve_stream(&srv, in, out) == SERVE_QUIT);
+    fclose(in);
+    fclose(out);
+    free_table(srv.table);
+    TEST_OK("Server mode verified");
+}
+
+/* Keys (low, CACHE_EXTRACT | y) that share the successor cache bucket of (from, j) */
+static uint64_t colliding_keys(node_table *table, node_id from, uint64_t j, node_id low, uint64_t *ys, uint64_t n)
+{
+    uint64_t mask = (table->size - 1) & ~(uint64_t)(CACHE_WAYS - 1);
+    uint64_t bucket = hash_quad(from, j, from, j) & mask, found = 0;
+    for (uint64_t y = 0; found < n && y < (1ULL << 27); y++)
+        if ((hash_quad(low, CACHE_EXTRACT | y, low, CACHE_EXTRACT | y) & mask) == bucket)
+            ys[found++] = y;
+    return found;
+}
+
+void test_cache_replacement()
+{
+    TEST_START("Testing successor cache replacement");
+    node_table *table = create_table(1024);
+    node_id top = read_rle(table, "pat/breeder.rle");
+    uint64_t j = LEVEL(top) - 2;
+    node_id next = successor_exact(table, top, j);
+    node_id low = join(table, table->on, table->off, table->off, table->off);
+    uint64_t ys[64];
+    assert(colliding_keys(table, top, j, low, ys, 64) == 64);
+    cache_next(table, top, next, j);
+
+    // a burst of cheap entries through the bucket leaves the top-level successor, while it is used
+    for (int k = 0; k < 60; k++)
+    {
+        cache_next(table, low, low, CACHE_EXTRACT | ys[k]);
+        assert(lookup_next(table, low, CACHE_EXTRACT | ys[k]) == low);
+        if (k % 2)
+            assert(lookup_next(table, top, j) == next);
+    }
+#if HL_STATS
+    assert(table->stats.succ_kept[STATS_BUCKET(LEVEL(top))] > 0);
+#endif
+
+    // ... but once unused, it ages out
+    for (int k = 60; k < 60 + CACHE_STALE + 1; k++)
+        cache_next(table, low, low, CACHE_EXTRACT | ys[k]);
+    assert(lookup_next(table, top, j) == UNUSED);
+    assert(successor_exact(table, top, j) == next);
+    verify_successor_cache(table);
+    free_table(table);
+    TEST_OK("Successor cache replacement verified");
+}
+
+void test_arena()
+{
+    TEST_START("Testing arena layout");
+    node_table *table = create_table_alloc(1024, ALLOC_DEFAULT | ALLOC_ARENA);
+    node_table *plain = create_table(1024);
+    node_id root = advance(table, read_rle(table, "pat/breeder.rle"), 1024);
+    node_id expect = advance(plain, read_rle(plain, "pat/breeder.rle"), 1024);
+    char *rle = to_rle(table, root), *expect_rle = to_rle(plain, expect);
+    assert(!strcmp(rle, expect_rle));
+    free(expect_rle);
+    verify_hashtable(table);
+
+    // depth first: the root, then its first child, and so on down
+    uint64_t count = table->count;
+    relayout(table, &root, 1, RELAYOUT_DFS);
+    assert(table->count == count);
+    node *n = lookup(table, root);
+    assert(n == &table->index[0] && lookup(table, n->a) == &table->index[1]);
+    verify_hashtable(table);
+    verify_tree(table, root, LEVEL(root));
+    char *after = to_rle(table, root);
+    assert(!strcmp(rle, after));
+    free(after);
+    // the successor cache survives: the same advance makes no new nodes
+    advance(table, read_rle(table, "pat/breeder.rle"), 1024);
+    assert(table->count == count);
+
+    // Morton: the root's four children straight after it
+    relayout(table, &root, 1, RELAYOUT_MORTON);
+    n = lookup(table, root);
+    assert(n == &table->index[0] && lookup(table, n->a) == &table->index[1] &&
+           lookup(table, n->b) == &table->index[2]);
+    verify_hashtable(table);
+    verify_successor_cache(table);
+
+    // nodes link to their children, and descents through the links agree with a plain table
+    assert(n->j == ARENA_LINKED && (n->from & 0xFFFFFFFF) == 1 && (n->from >> 32) == 2);
+    uint64_t size = 1ULL << LEVEL(root);
+    for (uint64_t k = 0; k < 4096; k++)
+    {
+        uint64_t x = (k * 7919) % size, y = (k * 104729) % size;
+        assert(get_cell(table, root, x, y, 0) == get_cell(plain, expect, x, y, 0));
+        assert(get_cell(table, root, x, y, 4) == get_cell(plain, expect, x, y, 4));
+    }
+    cell_iter it, plain_it;
+    int64_t xy[2 * 64], plain_xy[2 * 64];
+    uint64_t got;
+    cell_iter_init(table, &it, root, 0, 0);
+    cell_iter_init(plain, &plain_it, expect, 0, 0);
+    while ((got = cell_iter_next(&it, xy, 64)))
+    {
+        assert(cell_iter_next(&plain_it, plain_xy, 64) == got);
+        assert(!memcmp(xy, plain_xy, 2 * got * sizeof(int64_t)));
+    }
+
+    // vacuum keeps the order, and copies and forks are arenas too
+    vacuum(table, root);
+    assert(table->count < count && lookup(table, root) == &table->index[0]);
+    verify_hashtable(table);
+    verify_tree(table, root, LEVEL(root));
+    node_table *copy = copy_table(table);
+    node_table *fork = fork_table(table, 64);
+    assert(copy->dir && fork->dir);
+    node_id next = advance(fork, root, 64);
+    assert(lookup(fork, next)->pop == lookup(plain, advance(plain, expect, 64))->pop);
+    assert(lookup(copy, root) == &copy->index[0]);
+    free_table(fork);
+    free_table(copy);
+    free(rle);
+    free_table(table);
+    free_table(plain);
+    TEST_OK("Arena layout verified");
+}
+
+/* Wait for n children, checking that each exited cleanly */
+static void wait_children(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int status;
+        assert(wait(&status) > 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+void test_shared()
+{
+    TEST_START("Testing shared tables");
+    char name[64];
+    snprintf(name, sizeof(name), "/hashlife_test_%d", (int)getpid());
+    node_table *table = open_shared_table(name, 1 << 20, NULL);
+    assert(table && table->shared);
+    assert(set_rule(table, "B36/S23") == -1 && set_rule(table, "B3/S23") == 0);
+
+    // the same work in a private table, for comparison
+    node_table *private = create_table(1024);
+    node_id expect = advance(private, read_rle(private, "pat/breeder.rle"), 512);
+    uint64_t expect_pop[2] = {lookup(private, advance(private, read_rle(private, "pat/breeder.rle"), 256))->pop,
+                              lookup(private, advance(private, read_rle(private, "pat/breeder.rle"), 768))->pop};
+
+    // several processes intern the same nodes at once: each is stored once
+    fflush(stdout);
+    for (int i = 0; i < 3; i++)
+        if (fork() == 0)
+        {
+            node_table *t = open_shared_table(name, 0, NULL);
+            advance(t, read_rle(t, "pat/breeder.rle"), 512);
+            free_table(t);
+            _exit(0);
+        }
+    wait_children(3);
+    node_id root = read_rle(table, "pat/breeder.rle");
+    uint64_t before = table->shared->count;
+    node_id done = advance(table, root, 512); // every node, and the successors, are there already
+    assert(table->shared->count == before);
+    assert(lookup(table, done)->pop == lookup(private, expect)->pop);
+    table->count = table->shared->count;
+    verify_hashtable(table);
+    verify_children(table);
+
+    // vacuum is collective: each process keeps its own roots
+    fflush(stdout);
+    for (int i = 0; i < 2; i++)
+        if (fork() == 0)
+        {
+            node_table *t = open_shared_table(name, 0, NULL);
+            node_id mine = advance(t, read_rle(t, "pat/breeder.rle"), 256 + 512 * i);
+            vacuum_roots(t, &mine, 1);
+            assert(verify_tree(t, mine, LEVEL(mine)) == expect_pop[i]);
+            free_table(t);
+            _exit(0);
+        }
+    // a process that attaches after the vacuum has started would wait for the next one
+    while (__atomic_load_n(&table->shared->attached, __ATOMIC_ACQUIRE) < 3)
+        sched_yield();
+    vacuum_roots(table, &root, 1);
+    wait_children(2);
+    assert(table->count < before);
+    assert(verify_tree(table, root, LEVEL(root)) == lookup(private, read_rle(private, "pat/breeder.rle"))->pop);
+    verify_hashtable(table);
+    free_table(table);
+    assert(unlink_shared_table(name) == 0);
+
+    // a small table fills up: the poll stops for a vacuum, and then goes on
+    table = open_shared_table(name, 1 << 16, NULL);
+    advance_state state;
+    advance_begin(table, &state, read_rle(table, "pat/breeder.rle"), 512);
+    state.max_j = 3;
+    int rc, vacuums = 0;
+    while ((rc = advance_poll(table, &state, 0)) == ADVANCE_FULL)
+    {
+        vacuum_roots(table, &state.root, 1);
+        assert(table->count * SHARED_MAX_LOAD <= table->size);
+        vacuums++;
+    }
+    assert(rc == ADVANCE_DONE && vacuums > 0);
+    assert(lookup(table, advance_result(table, &state))->pop == lookup(private, expect)->pop);
+
+    // without a vacuum a chaotic soup fills it: advance() fails, leaving the table usable
+    assert(advance(table, random_soup(table, 1, 0, 64), 1 << 10) == UNUSED);
+    assert((table->size - table->shared->count) * SHARED_HARD_LOAD >= table->size);
+    assert(set_cells(table, get_zero(table, 3), (uint64_t[]){5000, 5000}, 1) == UNUSED);
+    vacuum_roots(table, NULL, 0);
+    root = read_rle(table, "pat/breeder.rle");
+    assert(lookup(table, advance(table, root, 512))->pop == lookup(private, expect)->pop);
+    free_table(table);
+    free_table(private);
+    assert(unlink_shared_table(name) == 0);
+    TEST_OK("Shared tables verified");
+}
+
 int main()
 {
     test_init();
+    test_alloc();
     test_zeros();
     test_set_get();
     test_pattern();
@@ -544,20 +1670,25 @@ int main()
     test_vacuum();
     test_advance();
     test_ffwd();
-
-    /* timing tests */
-    timing_table = create_table(131072);
-    timing_pattern = read_rle(timing_table, "pat/rendell.rle");
-
-    timeit(time_next, "Advance pattern ", 500, 50, 7);
-
-    timeit(time_advance_1, "Advance by 1", 500, 50, 7);
-    timeit(time_advance_64, "Advance by 64", 500, 50, 7);
-    timeit(time_advance_256, "Advance by 256", 500, 50, 7);
-    timing_table = create_table(131072);
-    timing_pattern = read_rle(timing_table, "pat/rendell.rle");
-
-    timeit(time_advance_65535, "Advance by 65535", 1, 1, 7);
-    timeit(time_advance_65536, "Advance by 65536", 500, 50, 7);
-    timeit(load_rle_time, "Load Gosper glider gun RLE", 1000, 100, 7);
+    test_resumable();
+    test_stepper();
+    test_pop_series();
+    test_extract();
+    test_advance_region();
+    test_diff();
+    test_cell_iter();
+    test_fork();
+    test_edits();
+    test_life_formats();
+    test_search();
+    test_period();
+    test_soup();
+    test_symmetry();
+    test_rules();
+    test_stats();
+    test_trace();
+    test_serve();
+    test_shared();
+    test_arena();
+    test_cache_replacement();
 }
@@ -1,5 +1,9 @@
-#include <stdint.h>
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "timeit.h"
 #include <stdio.h>
+#include <time.h>
 
 // keep the compiler from optimizing away the timed function calls
 static volatile uint64_t sink;
@@ -28,13 +32,9 @@ uint64_t now_ns(void)
 }
 
 #else
-#define _POSIX_C_SOURCE 200809L
-#include <time.h>
 
 uint64_t now_ns(void)
 {
-return 0;
-/*
     struct timespec ts;
 #ifdef CLOCK_MONOTONIC_RAW
     clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
@@ -42,7 +42,6 @@ return 0;
     clock_gettime(CLOCK_MONOTONIC, &ts);
 #endif
     return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
-    */
 }
 
 #endif
@@ -72,5 +71,5 @@ void timeit(int (*func)(void), const char *name, int iters, int warm, int trials
     printf("best of %d: %.6f s | %.2f ns/iter | result=%llu\n",
            trials,
            best_dt / 1e9,
-           (double)best_dt / iters, sink);
+           (double)best_dt / iters, (unsigned long long)sink);
 }
\ No newline at end of file
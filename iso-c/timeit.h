@@ -0,0 +1,11 @@
+#ifndef TIMEIT_H
+#define TIMEIT_H
+#include <stdint.h>
+
+/* Monotonic clock, in nanoseconds */
+uint64_t now_ns(void);
+
+/* Print the best of `trials` runs of `iters` calls to func */
+void timeit(int (*func)(void), const char *name, int iters, int warm, int trials);
+
+#endif // TIMEIT_H
@@ -0,0 +1,79 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+bool trace_enabled = false;
+uint64_t trace_min_level = 0;
+
+static trace_event *events = NULL;
+static uint64_t n_events = 0, max_events = 0, dropped = 0;
+static uint64_t trace_epoch = 0;
+
+/* Start (or resume) recording spans */
+void trace_start(uint64_t min_successor_level)
+{
+    if (n_events == 0)
+        trace_epoch = now_ns();
+    trace_min_level = min_successor_level;
+    trace_enabled = true;
+}
+
+void trace_stop(void)
+{
+    trace_enabled = false;
+}
+
+void trace_clear(void)
+{
+    free(events);
+    events = NULL;
+    n_events = max_events = dropped = 0;
+}
+
+uint64_t trace_count(void)
+{
+    return n_events;
+}
+
+/* Append a span that started at start_ns and ends now */
+void trace_record(const char *name, uint64_t start_ns, uint64_t level, const char *arg_name, uint64_t arg)
+{
+    uint64_t end = now_ns();
+    if (n_events == max_events)
+    {
+        if (max_events >= TRACE_MAX_EVENTS)
+        {
+            dropped++;
+            return;
+        }
+        max_events = max_events ? max_events * 2 : 4096;
+        events = realloc(events, max_events * sizeof(trace_event));
+    }
+    events[n_events++] = (trace_event){.name = name, .arg_name = arg_name, .start_ns = start_ns, .dur_ns = end - start_ns, .level = level, .arg = arg};
+}
+
+/* Write all spans as Chrome trace JSON ("X" complete events, times in us) */
+int trace_write_json(const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f)
+    {
+        printf("Failed to open trace file for writing: %s\n", filename);
+        return 1;
+    }
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": %llu}, \"traceEvents\": [\n",
+            (unsigned long long)dropped);
+    for (uint64_t i = 0; i < n_events; i++)
+    {
+        trace_event *e = &events[i];
+        fprintf(f, "{\"name\": \"%s\", \"cat\": \"hashlife\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                   "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"level\": %llu",
+                e->name, (e->start_ns - trace_epoch) / 1e3, e->dur_ns / 1e3, (unsigned long long)e->level);
+        if (e->arg_name)
+            fprintf(f, ", \"%s\": %llu", e->arg_name, (unsigned long long)e->arg);
+        fprintf(f, "}}%s\n", i + 1 < n_events ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "timeit.h"
+
+/* Trace events
+
+Records timestamped spans (advance bit-steps, ffwd leaps, successor calls
+at or above a chosen level, resizes, vacuums and pattern I/O) and exports
+them as Chrome / Perfetto trace JSON, viewable in ui.perfetto.dev or
+chrome://tracing.
+
+Recording is off until trace_start(); while off, each span costs one
+test of trace_enabled. Build with -DHL_TRACE=0 to compile spans out.
+
+The event buffer is global and not thread-safe: trace from one thread.
+*/
+
+#ifndef HL_TRACE
+#define HL_TRACE 1
+#endif
+
+#define TRACE_MAX_EVENTS (16u << 20) // further events are counted as dropped
+
+typedef struct trace_event
+{
+    const char *name;
+    const char *arg_name; // name of the extra argument (or NULL)
+    uint64_t start_ns, dur_ns;
+    uint64_t level, arg;
+} trace_event;
+
+extern bool trace_enabled;
+extern uint64_t trace_min_level; // successor spans are only kept at this level and above
+
+void trace_start(uint64_t min_successor_level);
+void trace_stop(void);
+void trace_clear(void);
+uint64_t trace_count(void);
+void trace_record(const char *name, uint64_t start_ns, uint64_t level, const char *arg_name, uint64_t arg);
+int trace_write_json(const char *filename);
+
+#if HL_TRACE
+/* Open a span named t, if tracing is on and cond holds */
+#define TRACE_BEGIN(t, cond) uint64_t t = (trace_enabled && (cond)) ? now_ns() : 0
+/* Close span t, recording it if it was opened */
+#define TRACE_END(t, name, level, arg_name, arg)           \
+    do                                                     \
+    {                                                      \
+        if (t)                                             \
+            trace_record(name, t, level, arg_name, arg);   \
+    } while (0)
+#else
+#define TRACE_BEGIN(t, cond) (void)0
+#define TRACE_END(t, name, level, arg_name, arg) (void)(arg)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,33 @@
+"""
+Builds hashlife_c, the iso-c engine as a Python extension module:
+
+    python setup.py build_ext --inplace
+
+hashlife_c has the same construct() / advance() / expand() API as hashlife.py.
+"""
+from setuptools import setup, Extension
+
+sources = [
+    "pyhashlife.c",
+    "hashlife.c",
+    "shared.c",
+    "cell_io.c",
+    "rule.c",
+    "table_alloc.c",
+    "stats.c",
+    "trace.c",
+    "timeit.c",
+]
+
+setup(
+    name="hashlife_c",
+    version="0.1",
+    description="Gosper's hashlife algorithm, in C, for Python",
+    ext_modules=[
+        Extension(
+            "hashlife_c",
+            sources=["iso-c/" + src for src in sources],
+            extra_compile_args=["-std=c11", "-O3", "-DNDEBUG"],
+        )
+    ],
+)
@@ -14,7 +14,11 @@ from hashlife import (
     baseline_life,
     advance,
     ffwd,
+    collect,
+    expand_array,
+    expand_recursive,
 )
+import hashlife
 from lifeparsers import autoguess_life_file
 from itertools import product
 import os
@@ -180,6 +184,41 @@ def test_pad():
     assert not is_padded(node)
 
 
+def test_expand_array():
+    node = advance(construct(test_pattern), 100)
+    for level in range(4):
+        for clip in [None, (0, 20, 0, 20), (10, 1000, 5, 12)]:
+            expected = sorted(expand_recursive(node, 3, 4, clip, level))
+            assert sorted(expand(node, 3, 4, clip, level)) == expected
+            xs, ys, gray = expand_array(node, 3, 4, clip, level)
+            assert sorted(zip(xs.tolist(), ys.tolist(), gray.tolist())) == expected
+
+
+def test_collect():
+    node = construct(test_pattern)
+    later = advance(node, 1000)
+    kept = collect(node, later)
+    assert kept == join.cache_info().currsize
+    # everything reachable is still interned, so equal patterns are still the same node
+    assert construct(test_pattern) is node
+    assert advance(node, 1000) is later
+    assert get_zero(8) is get_zero(8)
+    validate_tree(later)
+
+
+def test_collect_limit(monkeypatch):
+    # a small limit: advance() collects as it goes, and the result is unchanged
+    node = construct(test_pattern)
+    expected = sorted(expand(advance(node, 300)))
+    monkeypatch.setattr(hashlife, "collect_limit", 1000)
+    monkeypatch.setattr(hashlife, "_collect_at", 0)
+    collect(node)
+    later = advance(node, 300)
+    assert sorted(expand(later)) == expected
+    assert hashlife._collect_at > 0  # it did collect
+    validate_tree(later)
+
+
 @lru_cache(None)
 def validate_tree(node):
     if node.k > 0:
@@ -196,3 +235,71 @@ def validate_tree(node):
         validate_tree(node.c)
         validate_tree(node.d)
 
+
+
+# The C engine, if it has been built (python setup.py build_ext --inplace)
+try:
+    import hashlife_c
+except ImportError:
+    hashlife_c = None
+
+needs_c = pytest.mark.skipif(hashlife_c is None, reason="hashlife_c is not built")
+
+
+@needs_c
+def test_c_baseline():
+    for fname in [test_fname, "lifep/acorn.lif", "lifep/oscsp4.lif"]:
+        pat, _ = autoguess_life_file(fname)
+        node = hashlife_c.construct(pat)
+        validate_tree(node)
+        assert same_pattern(pat, hashlife_c.expand(node))
+        for i in range(64):
+            assert same_pattern(pat, hashlife_c.expand(hashlife_c.advance(node, i)))
+            pat = baseline_life(pat)
+
+
+@needs_c
+def test_c_tree():
+    h = hashlife_c
+    node = h.construct(test_pattern)
+    for i in range(5):
+        bigger = h.centre(node)
+        assert bigger.k == node.k + 1 and bigger.n == node.n
+        assert h.inner(bigger) == node
+        node = bigger
+    assert h.is_padded(h.pad(node)) and not h.is_padded(h.crop(node))
+    assert h.join(h.on, h.off, h.off, h.on).n == 2
+    assert h.get_zero(40).k == 40 and h.get_zero(40).n == 0
+    step = h.successor(h.centre(h.centre(node)), 0)
+    assert same_pattern(baseline_life(test_pattern), h.expand(step))
+    pat = test_pattern
+    node, gens = h.ffwd(h.construct(pat), 2)
+    for i in range(gens):
+        pat = baseline_life(pat)
+    assert same_pattern(pat, h.expand(node))
+
+
+@needs_c
+def test_c_io_vacuum():
+    h = hashlife_c
+    node = h.read_life("lifep/breeder.lif")
+    assert node.n == len(autoguess_life_file("lifep/breeder.lif")[0])
+    assert h.from_rle(h.to_rle(node)) == node
+    edited = h.set_cell(node, 1, 2)
+    assert edited.n == node.n + 1 and h.get_cell(edited, 1, 2) == 1.0
+    size = 1 << node.k
+    raster = h.rasterise(node, 0, 0, size, size, level=2)
+    assert raster.shape == (size >> 2, size >> 2)
+    assert sum(raster.cast("B").cast("f")) * 16 == node.n
+    rle = h.to_rle(node)
+    big = h.advance(node, 1000)
+    count = h.node_count()
+    del big
+    assert h.vacuum() < count
+    # every live Node survives the vacuum
+    assert h.to_rle(node) == rle and h.get_cell(edited, 1, 2) == 1.0
+    # a rule the engine cannot run is an error, not a pattern under the old rule
+    rule = h.get_rule()
+    with pytest.raises(ValueError):
+        h.from_rle("x = 3, y = 1, rule = B9/S9\n3o!")
+    assert h.get_rule() == rule